@@ -0,0 +1,217 @@
+/**
+ * @file aesd-circular-buffer-spmc.c
+ * @brief Single producer, multiple consumer circular buffer using C11 atomics
+ *
+ * Each slot is protected like a seqlock. The producer marks the slot odd,
+ * copies the entry in, marks it even with the entry sequence number and only
+ * then publishes the entry by advancing `head`. A consumer checks the slot
+ * stamp before and after copying the entry out, and discards the copy if the
+ * producer reused the slot in between.
+ *
+ * As in any seqlock, a consumer may copy slot data while the producer writes
+ * it. The C11 memory model calls these overlapping plain copies a data race.
+ * Copying through relaxed atomic words would avoid that, but it makes the
+ * producer several times slower on large entries. So the copies stay memcpy,
+ * and a torn copy is always detected and discarded. ThreadSanitizer reports
+ * the overlap unless it runs with tsan.supp.
+ *
+ */
+
+#ifndef __KERNEL__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd-circular-buffer-spmc.h"
+
+/**
+ * @return the stamp of a slot holding the complete entry @param seq
+ */
+static uint64_t complete_stamp(uint64_t seq) { return 2 * seq + 2; }
+
+static struct aesd_spmc_slot *slot_for(struct aesd_spmc_buffer *buffer,
+                                       uint64_t seq) {
+  return &buffer->slots[seq % buffer->capacity];
+}
+
+static char *slot_data_for(struct aesd_spmc_buffer *buffer, uint64_t seq) {
+  return buffer->data + (seq % buffer->capacity) * buffer->slot_size;
+}
+
+/**
+ * Allocates @param capacity slots of @param slot_size bytes for @param buffer.
+ * @return 0 if successful, -1 with errno set otherwise
+ */
+int aesd_spmc_buffer_init(struct aesd_spmc_buffer *buffer, size_t capacity,
+                          size_t slot_size) {
+  memset(buffer, 0, sizeof(struct aesd_spmc_buffer));
+  if (capacity == 0 || slot_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  buffer->slots = calloc(capacity, sizeof(struct aesd_spmc_slot));
+  buffer->data = malloc(capacity * slot_size);
+  if (NULL == buffer->slots || NULL == buffer->data) {
+    aesd_spmc_buffer_free(buffer);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  buffer->capacity = capacity;
+  buffer->slot_size = slot_size;
+  for (size_t index = 0; index < capacity; index++) {
+    atomic_init(&buffer->slots[index].stamp, 0);
+    atomic_init(&buffer->slots[index].size, 0);
+  }
+  atomic_init(&buffer->head, 0);
+  return 0;
+}
+
+/**
+ * Releases the slots of @param buffer. No producer or consumer may still be
+ * using it.
+ */
+void aesd_spmc_buffer_free(struct aesd_spmc_buffer *buffer) {
+  free(buffer->slots);
+  free(buffer->data);
+  buffer->slots = NULL;
+  buffer->data = NULL;
+}
+
+/**
+ * Copies @param size bytes of @param data into @param buffer as the newest
+ * entry, overwriting the oldest one if all slots are used. Must only be called
+ * from one thread at a time.
+ * @return 0 if successful
+ * @return -1 with errno set to EMSGSIZE if @param size is larger than the
+ * slot size
+ */
+int aesd_spmc_buffer_append(struct aesd_spmc_buffer *buffer, const char *data,
+                            size_t size) {
+  if (size > buffer->slot_size) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  // Only this thread writes `head`
+  const uint64_t seq =
+      atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  struct aesd_spmc_slot *slot = slot_for(buffer, seq);
+
+  // Mark the slot as being written before touching its data
+  atomic_store_explicit(&slot->stamp, complete_stamp(seq) - 1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  // Deliberately races with consumers copying the slot, see the file comment
+  memcpy(slot_data_for(buffer, seq), data, size);
+  atomic_store_explicit(&slot->size, size, memory_order_relaxed);
+
+  atomic_store_explicit(&slot->stamp, complete_stamp(seq),
+                        memory_order_release);
+  atomic_store_explicit(&buffer->head, seq + 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * @return the sequence number the next appended entry of @param buffer will
+ * get
+ */
+uint64_t aesd_spmc_buffer_head(struct aesd_spmc_buffer *buffer) {
+  return atomic_load_explicit(&buffer->head, memory_order_acquire);
+}
+
+/**
+ * @return the sequence number of the oldest entry retained by @param buffer,
+ * equal to the head when it is empty
+ */
+uint64_t aesd_spmc_buffer_tail(struct aesd_spmc_buffer *buffer) {
+  const uint64_t head = aesd_spmc_buffer_head(buffer);
+  return head > buffer->capacity ? head - buffer->capacity : 0;
+}
+
+/**
+ * Copies entry @param seq of @param buffer into @param out. Safe to call from
+ * any number of threads while the producer appends.
+ * @param size_rtn receives the size of the entry when the result is
+ * AESD_SPMC_OK or AESD_SPMC_TOO_SMALL
+ * @return the outcome, see enum aesd_spmc_result
+ */
+enum aesd_spmc_result aesd_spmc_buffer_read(struct aesd_spmc_buffer *buffer,
+                                            uint64_t seq, char *out,
+                                            size_t out_size,
+                                            size_t *size_rtn) {
+  const uint64_t head = aesd_spmc_buffer_head(buffer);
+  if (seq >= head) {
+    return AESD_SPMC_EMPTY;
+  }
+  if (head - seq > buffer->capacity) {
+    return AESD_SPMC_OVERWRITTEN;
+  }
+
+  struct aesd_spmc_slot *slot = slot_for(buffer, seq);
+  const uint64_t stamp =
+      atomic_load_explicit(&slot->stamp, memory_order_acquire);
+  if (stamp != complete_stamp(seq)) {
+    // A later entry is being written, or was written, into the slot
+    return AESD_SPMC_OVERWRITTEN;
+  }
+
+  const size_t size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+  enum aesd_spmc_result result = AESD_SPMC_OK;
+  if (size > out_size) {
+    result = AESD_SPMC_TOO_SMALL;
+  } else {
+    // May race with the producer reusing the slot, checked below
+    memcpy(out, slot_data_for(buffer, seq), size);
+  }
+
+  // Discard what was read if the producer reused the slot meanwhile
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&slot->stamp, memory_order_relaxed) != stamp) {
+    return AESD_SPMC_OVERWRITTEN;
+  }
+
+  *size_rtn = size;
+  return result;
+}
+
+/**
+ * Copies the entry at @param cursor of @param buffer into @param out and
+ * advances the cursor past it. If the consumer fell behind and the entry was
+ * overwritten, the cursor skips ahead to the oldest retained entry and the read
+ * is retried.
+ * @param skipped_rtn receives the number of entries skipped, may be NULL. It is
+ * set for every result, including AESD_SPMC_EMPTY when the cursor skipped
+ * ahead to the head.
+ * @return AESD_SPMC_OK, AESD_SPMC_EMPTY when the cursor is at the head, or
+ * AESD_SPMC_TOO_SMALL when the entry does not fit and the cursor is left on it
+ */
+enum aesd_spmc_result
+aesd_spmc_buffer_read_next(struct aesd_spmc_buffer *buffer, uint64_t *cursor,
+                           char *out, size_t out_size, size_t *size_rtn,
+                           uint64_t *skipped_rtn) {
+  uint64_t skipped = 0;
+  enum aesd_spmc_result result;
+  while ((result = aesd_spmc_buffer_read(buffer, *cursor, out, out_size,
+                                         size_rtn)) == AESD_SPMC_OVERWRITTEN) {
+    const uint64_t tail = aesd_spmc_buffer_tail(buffer);
+    // The entry may have been overwritten after the tail was read, so always
+    // move forward by at least one entry
+    const uint64_t next = tail > *cursor ? tail : *cursor + 1;
+    skipped += next - *cursor;
+    *cursor = next;
+  }
+
+  if (result == AESD_SPMC_OK) {
+    (*cursor)++;
+  }
+  if (NULL != skipped_rtn) {
+    *skipped_rtn = skipped;
+  }
+  return result;
+}
+
+#endif /* __KERNEL__ */
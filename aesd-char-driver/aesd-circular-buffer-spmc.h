@@ -0,0 +1,99 @@
+/*
+ * aesd-circular-buffer-spmc.h
+ *
+ *  Lock-free variant of the aesd circular buffer for userspace: a single
+ *  producer appends entries while any number of consumers read them, without a
+ *  mutex. Entries are numbered by a 64 bit sequence number starting at 0 and
+ *  copied into slots owned by the buffer, so the producer can overwrite the
+ *  oldest entry at any time. A consumer that was overwritten while copying an
+ *  entry notices and is told to resume from the oldest retained entry.
+ *
+ *  Only available outside the kernel, it relies on C11 atomics.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_SPMC_H
+#define AESD_CIRCULAR_BUFFER_SPMC_H
+
+#ifndef __KERNEL__
+
+#include <stdatomic.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+
+struct aesd_spmc_slot {
+  /**
+   * 2 * seq + 1 while entry `seq` is being written into the slot, and
+   * 2 * seq + 2 once it is complete. 0 before the first write.
+   */
+  atomic_uint_fast64_t stamp;
+  /**
+   * Number of bytes of the entry stored in the slot data
+   */
+  atomic_size_t size;
+};
+
+struct aesd_spmc_buffer {
+  /**
+   * Number of slots, the maximum number of retained entries
+   */
+  size_t capacity;
+  /**
+   * Maximum number of bytes in one entry
+   */
+  size_t slot_size;
+  struct aesd_spmc_slot *slots;
+  /**
+   * `capacity` regions of `slot_size` bytes holding the entry data
+   */
+  char *data;
+  /**
+   * Sequence number of the next entry to append, the number of entries
+   * appended so far. Only written by the producer.
+   */
+  atomic_uint_fast64_t head;
+};
+
+enum aesd_spmc_result {
+  /**
+   * The entry was copied
+   */
+  AESD_SPMC_OK = 0,
+  /**
+   * The entry has not been appended yet
+   */
+  AESD_SPMC_EMPTY,
+  /**
+   * The entry was overwritten before or while it was copied
+   */
+  AESD_SPMC_OVERWRITTEN,
+  /**
+   * The entry is larger than the destination, its size is returned
+   */
+  AESD_SPMC_TOO_SMALL,
+};
+
+int aesd_spmc_buffer_init(struct aesd_spmc_buffer *buffer, size_t capacity,
+                          size_t slot_size);
+
+void aesd_spmc_buffer_free(struct aesd_spmc_buffer *buffer);
+
+int aesd_spmc_buffer_append(struct aesd_spmc_buffer *buffer, const char *data,
+                            size_t size);
+
+uint64_t aesd_spmc_buffer_head(struct aesd_spmc_buffer *buffer);
+
+uint64_t aesd_spmc_buffer_tail(struct aesd_spmc_buffer *buffer);
+
+enum aesd_spmc_result aesd_spmc_buffer_read(struct aesd_spmc_buffer *buffer,
+                                            uint64_t seq, char *out,
+                                            size_t out_size,
+                                            size_t *size_rtn);
+
+enum aesd_spmc_result
+aesd_spmc_buffer_read_next(struct aesd_spmc_buffer *buffer, uint64_t *cursor,
+                           char *out, size_t out_size, size_t *size_rtn,
+                           uint64_t *skipped_rtn);
+
+#endif /* __KERNEL__ */
+
+#endif /* AESD_CIRCULAR_BUFFER_SPMC_H */
@@ -22,41 +22,36 @@
 #include "aesd-circular-buffer.h"
 
 /**
- * @brief returns the next index in the circular buffer while accounting for
- * wrap-around.
- * @param index the current index
- * @return the next index
+ * The ring operations on the entries, specialised for the entry count
  */
-static size_t next_idx(const size_t index) {
-  return (index + 1) >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? 0
-                                                                : (index + 1);
-}
+DEFINE_RING_FUNCTIONS(aesd_entry_ring, aesd_circular_buffer,
+                      struct aesd_buffer_entry,
+                      AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
 
 /**
- * @brief returns true if the `buffer` is empty.
+ * State of a search for the entry holding a position, see entry_holds_fpos.
  */
-static bool is_empty(struct aesd_circular_buffer *buffer) {
-  return (!buffer->full) && (buffer->in_offs == buffer->out_offs);
-}
+struct fpos_search {
+  size_t char_offset;
+  /**
+   * Position of the first byte of the entry being checked
+   */
+  size_t entry_start;
+};
 
 /**
- * @brief returns the `buffer` entry offset from the `out_offs` by `offset`.
- * This does not move the `out_offs` index.
+ * @brief returns true if `entry` holds the position searched for in `context`,
+ * a struct fpos_search. Entries are checked oldest first, each one that does
+ * not match moves the search past its bytes.
  */
-static struct aesd_buffer_entry *peek(struct aesd_circular_buffer *buffer,
-                                      const size_t offset) {
-  if (is_empty(buffer)) {
-    return NULL;
+static bool entry_holds_fpos(const struct aesd_buffer_entry *entry,
+                             void *context) {
+  struct fpos_search *search = context;
+  if (search->char_offset - search->entry_start < entry->size) {
+    return true;
   }
-
-  if (offset >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
-    // TODO: update print
-    // printf("Warning: `offset` exceeds buffer size\r\n");
-  }
-
-  const size_t peek_idx =
-      (buffer->out_offs + offset) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-  return &(buffer->entry[peek_idx]);
+  search->entry_start += entry->size;
+  return false;
 }
 
 /**
@@ -76,30 +71,31 @@ static struct aesd_buffer_entry *peek(struct aesd_circular_buffer *buffer,
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
     struct aesd_circular_buffer *buffer, size_t char_offset,
     size_t *entry_offset_byte_rtn) {
+  size_t entry_index = 0;
+  return aesd_circular_buffer_find_entry_index_for_fpos(
+      buffer, char_offset, entry_offset_byte_rtn, &entry_index);
+}
 
-  size_t current_char_offset = 0; // Keeps track of total bytes searched
-  for (size_t peek_idx = 0; peek_idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-       ++peek_idx) {
-    // Loop through the circular buffer starting with the `out` idx.
-    struct aesd_buffer_entry *current_entry = peek(buffer, peek_idx);
-    if (current_entry == NULL) {
-      return NULL;
-    }
-
-    const size_t current_max_offset =
-        current_char_offset + (current_entry->size - 1);
-    if (current_max_offset >= char_offset) {
-      // This entry contains the requested offset
-      size_t buffer_idx = char_offset - current_char_offset;
-      *entry_offset_byte_rtn = buffer_idx;
-      return current_entry;
-    }
-
-    current_char_offset += current_entry->size;
+/**
+ * Same as aesd_circular_buffer_find_entry_offset_for_fpos, and also stores
+ * the position of the returned entry after the oldest entry, as used by
+ * aesd_circular_buffer_get_entry, in @param entry_index_rtn.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_index_for_fpos(
+    struct aesd_circular_buffer *buffer, size_t char_offset,
+    size_t *entry_offset_byte_rtn, size_t *entry_index_rtn) {
+  // Only the held entries are searched, slots past them may still describe
+  // removed entries
+  struct fpos_search search = {.char_offset = char_offset, .entry_start = 0};
+  struct aesd_buffer_entry *entry = aesd_entry_ring_find(
+      buffer, entry_holds_fpos, &search, entry_index_rtn);
+  if (entry == NULL) {
+    // Not enough data
+    return NULL;
   }
 
-  // Not enough data
-  return NULL;
+  *entry_offset_byte_rtn = char_offset - search.entry_start;
+  return entry;
 }
 
 /**
@@ -109,6 +105,12 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
  * locking must be handled by the caller Any memory referenced in @param
  * add_entry must be allocated by and/or must have a lifetime managed by the
  * caller.
+ *
+ * When buffer->max_size is set, the oldest entries are first removed until
+ * @param add_entry fits within it. An entry larger than max_size is still
+ * added, as the only entry. The pointers of entries removed for max_size are
+ * not returned, so a caller setting max_size must not rely on the return value
+ * to release entry memory.
  */
 const char *
 aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
@@ -121,27 +123,122 @@ aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
   if (add_entry->size == 0) {
     return NULL;
   }
-// If the buffer is full, return the buffptr so it can be freed
+
+  // Make room in the byte budget, oldest entries first
+  if (buffer->max_size != 0) {
+    while ((buffer->total_size + add_entry->size > buffer->max_size) &&
+           (aesd_circular_buffer_remove_entry(buffer) != NULL)) {
+    }
+  }
+
+  // If the buffer is full, return the buffptr so it can be freed
   const char *replaced_buffptr = NULL;
-  if (buffer->full) {
-    replaced_buffptr = buffer->entry[buffer->in_offs].buffptr;
+  if (aesd_entry_ring_is_full(buffer)) {
+    const struct aesd_buffer_entry *oldest = aesd_entry_ring_peek(buffer, 0);
+    replaced_buffptr = oldest->buffptr;
+    buffer->total_size -= oldest->size;
+    buffer->generation++;
   }
+  buffer->total_size += add_entry->size;
 
-  // Add `add_entry` to `buffer`
-  memcpy(&buffer->entry[buffer->in_offs], add_entry, sizeof(*add_entry));
+  aesd_entry_ring_push(buffer, add_entry);
+  return replaced_buffptr;
+}
 
-  // Increment the `in` pointer accounting for wrap-around
-  buffer->in_offs = next_idx(buffer->in_offs);
+/**
+ * @return the number of entries currently stored in @param buffer.
+ */
+size_t aesd_circular_buffer_entry_count(struct aesd_circular_buffer *buffer) {
+  return aesd_entry_ring_count(buffer);
+}
+
+/**
+ * @return the entry @param index places after the oldest entry in @param
+ * buffer, or NULL if the buffer holds fewer entries. Any necessary locking
+ * must be performed by the caller.
+ */
+struct aesd_buffer_entry *
+aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+                               size_t index) {
+  return aesd_entry_ring_peek(buffer, index);
+}
 
-  if (buffer->full) {
-    // If the buffer was already full, increment the `out` pointer too
-    buffer->out_offs = buffer->in_offs;
-  } else if (buffer->in_offs == buffer->out_offs) {
-    // If `in` pointer equals `out` pointer, then the buffer is now full
-    buffer->full = true;
+/**
+ * Removes the oldest entry from @param buffer and advances buffer->out_offs.
+ * Any necessary locking must be handled by the caller.
+ * @return the removed entry so any memory it references can be released, or
+ * NULL if the buffer was empty. The returned entry is overwritten by the next
+ * call to aesd_circular_buffer_add_entry.
+ */
+struct aesd_buffer_entry *
+aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer) {
+  struct aesd_buffer_entry *removed_entry = aesd_entry_ring_pop(buffer);
+  if (removed_entry == NULL) {
+    return NULL;
   }
 
-  return replaced_buffptr;
+  buffer->total_size -= removed_entry->size;
+  buffer->generation++;
+
+  return removed_entry;
+}
+
+/**
+ * Sets the byte budget of @param buffer to @param max_size, 0 for no limit,
+ * and removes the oldest entries until the retained entries fit within it. Any
+ * necessary locking must be handled by the caller.
+ */
+void aesd_circular_buffer_set_max_size(struct aesd_circular_buffer *buffer,
+                                       size_t max_size) {
+  buffer->max_size = max_size;
+  if (max_size == 0) {
+    return;
+  }
+
+  while ((buffer->total_size > max_size) &&
+         (aesd_circular_buffer_remove_entry(buffer) != NULL)) {
+  }
+}
+
+/**
+ * Describes the bytes from @param char_offset to @param char_offset + @param
+ * count of the concatenated entries of @param buffer as one span per entry
+ * touched, in order, so the range can be copied or sent with a single vectored
+ * call. The range is clipped to the data held by the buffer. Any necessary
+ * locking must be performed by the caller, and the spans are only valid until
+ * the buffer is next modified.
+ * @param spans array receiving at most @param max_spans spans
+ * @param bytes_rtn receives the number of bytes covered by the spans, which is
+ * less than count when the range runs past the end of the data or needs more
+ * than max_spans spans
+ * @return the number of spans filled
+ */
+size_t aesd_circular_buffer_fill_spans(struct aesd_circular_buffer *buffer,
+                                       size_t char_offset, size_t count,
+                                       struct aesd_buffer_span *spans,
+                                       size_t max_spans, size_t *bytes_rtn) {
+  size_t entry_offset = 0;
+  size_t index = 0;
+  size_t span_count = 0;
+  *bytes_rtn = 0;
+
+  struct aesd_buffer_entry *entry =
+      aesd_circular_buffer_find_entry_index_for_fpos(buffer, char_offset,
+                                                     &entry_offset, &index);
+  while (entry != NULL && *bytes_rtn < count && span_count < max_spans) {
+    const size_t remaining = count - *bytes_rtn;
+    const size_t available = entry->size - entry_offset;
+    spans[span_count].buffptr = entry->buffptr + entry_offset;
+    spans[span_count].size = remaining < available ? remaining : available;
+    *bytes_rtn += spans[span_count].size;
+    span_count++;
+
+    // Every following entry is covered from its start
+    entry_offset = 0;
+    entry = aesd_circular_buffer_get_entry(buffer, ++index);
+  }
+
+  return span_count;
 }
 
 /**
@@ -16,6 +16,8 @@
 #include <stdint.h> // uintx_t
 #endif
 
+#include "aesd-ring.h"
+
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
 struct aesd_buffer_entry {
@@ -29,35 +31,68 @@ struct aesd_buffer_entry {
   size_t size;
 };
 
+/**
+ * A contiguous run of bytes within one entry, as filled by
+ * aesd_circular_buffer_fill_spans. Maps directly onto a struct iovec or kvec.
+ */
+struct aesd_buffer_span {
+  const char *buffptr;
+  size_t size;
+};
+
 struct aesd_circular_buffer {
   /**
-   * An array of pointers to memory allocated for the most recent write
-   * operations
+   * `entry`, an array of pointers to memory allocated for the most recent
+   * write operations, and the `in_offs`, `out_offs` and `full` ring state, see
+   * aesd-ring.h
    */
-  struct aesd_buffer_entry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+  RING_FIELDS(struct aesd_buffer_entry,
+              AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
   /**
-   * The current location in the entry structure where the next write should
-   * be stored.
+   * Sum of the sizes of all entries currently in the buffer
    */
-  uint8_t in_offs;
+  size_t total_size;
   /**
-   * The first location in the entry structure to read from
+   * Byte budget for the sum of entry sizes, 0 for no limit. Set with
+   * aesd_circular_buffer_set_max_size.
    */
-  uint8_t out_offs;
+  size_t max_size;
   /**
-   * set to true when the buffer entry structure is full
+   * Incremented each time entries leave the buffer, which shifts the index of
+   * every remaining entry. Lets callers tell if an index they kept is stale.
    */
-  bool full;
+  size_t generation;
 };
 
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
     struct aesd_circular_buffer *buffer, size_t char_offset,
     size_t *entry_offset_byte_rtn);
 
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_index_for_fpos(
+    struct aesd_circular_buffer *buffer, size_t char_offset,
+    size_t *entry_offset_byte_rtn, size_t *entry_index_rtn);
+
 const char *
 aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
                                const struct aesd_buffer_entry *add_entry);
 
+size_t aesd_circular_buffer_entry_count(struct aesd_circular_buffer *buffer);
+
+struct aesd_buffer_entry *
+aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+                               size_t index);
+
+struct aesd_buffer_entry *
+aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer);
+
+void aesd_circular_buffer_set_max_size(struct aesd_circular_buffer *buffer,
+                                       size_t max_size);
+
+size_t aesd_circular_buffer_fill_spans(struct aesd_circular_buffer *buffer,
+                                       size_t char_offset, size_t count,
+                                       struct aesd_buffer_span *spans,
+                                       size_t max_spans, size_t *bytes_rtn);
+
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
 /**
@@ -78,4 +113,21 @@ void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
        index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;                        \
        index++, entryptr = &((buffer)->entry[index]))
 
+/**
+ * Create a for loop to iterate over the entries currently held by the circular
+ * buffer only, oldest first, skipping unused slots.
+ * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
+ * @param buffer is the struct aesd_buffer * describing the buffer
+ * @param index is a size_t stack allocated value used by this macro for the
+ * position of the current entry after the oldest one
+ * Example usage: size_t index; struct aesd_buffer_entry *entry;
+ * AESD_CIRCULAR_BUFFER_FOREACH_VALID(entry,&buffer,index) {
+ *      total += entry->size;
+ * }
+ */
+#define AESD_CIRCULAR_BUFFER_FOREACH_VALID(entryptr, buffer, index)            \
+  for (index = 0;                                                              \
+       (entryptr = aesd_circular_buffer_get_entry((buffer), index)) != NULL;   \
+       index++)
+
 #endif /* AESD_CIRCULAR_BUFFER_H */
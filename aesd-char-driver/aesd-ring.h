@@ -0,0 +1,161 @@
+/*
+ * aesd-ring.h
+ *
+ *  Generator macros for statically sized circular buffers of any element
+ *  type, with the overwrite-oldest semantics of the aesd circular buffer.
+ *  Every function is static inline and the capacity is a compile time
+ *  constant, so each instance compiles down to its own specialised code.
+ *  Power of two capacities wrap with a mask, others with a compare.
+ *
+ *  DEFINE_RING(name, type, capacity) declares `struct name` and its functions:
+ *    void name_init(struct name *ring)
+ *    size_t name_count(const struct name *ring)
+ *    bool name_is_empty(const struct name *ring)
+ *    bool name_is_full(const struct name *ring)
+ *    type *name_push(struct name *ring, const type *item)
+ *        copies `item` in as the newest element and returns the slot it was
+ *        stored in. When the ring was full the oldest element is overwritten,
+ *        copy it out first with name_peek(ring, 0) if it is still needed.
+ *    type *name_pop(struct name *ring)
+ *        removes the oldest element and returns its slot, valid until the next
+ *        push, or NULL if the ring is empty
+ *    type *name_peek(struct name *ring, size_t index)
+ *        returns the element `index` places after the oldest one, or NULL if
+ *        the ring holds fewer elements
+ *    type *name_find(struct name *ring, match, context, size_t *index_rtn)
+ *        returns the oldest element for which
+ *        `bool match(const type *element, void *context)` is true and stores
+ *        its index in `index_rtn`, or returns NULL
+ *
+ *  `type` is qualified as `const type *`, so pointer element types need a
+ *  typedef first.
+ *
+ *  To add fields of your own, declare the struct with RING_FIELDS and generate
+ *  only the functions with DEFINE_RING_FUNCTIONS, as aesd_circular_buffer does.
+ *  Any necessary locking must be handled by the caller.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <string.h>
+#endif
+
+/**
+ * True when @param capacity is a power of two, so indexes can wrap with a mask
+ */
+#define RING_CAPACITY_IS_POW2(capacity) (((capacity) & ((capacity)-1)) == 0)
+
+/**
+ * The members every ring struct starts with: `entry`, the @param capacity
+ * elements of @param type, `in_offs`, where the next element will be stored,
+ * `out_offs`, the oldest element when the ring is not empty, and `full`, set
+ * when every element is in use.
+ */
+#define RING_FIELDS(type, capacity)                                            \
+  type entry[capacity];                                                        \
+  uint32_t in_offs;                                                            \
+  uint32_t out_offs;                                                           \
+  bool full
+
+/**
+ * Generates the functions of a ring, see the top of this file
+ * @param name prefix of the generated functions
+ * @param ring_struct tag of a struct declared with RING_FIELDS(type, capacity)
+ */
+#define DEFINE_RING_FUNCTIONS(name, ring_struct, type, capacity)               \
+  _Static_assert((capacity) > 0 && (capacity) <= 0xffffffffULL,               \
+                 #name " capacity must fit the ring indexes");                 \
+                                                                               \
+  static inline size_t name##_wrap(size_t index) {                             \
+    if (RING_CAPACITY_IS_POW2(capacity)) {                                     \
+      return index & ((capacity)-1);                                           \
+    }                                                                          \
+    return index >= (capacity) ? index - (capacity) : index;                   \
+  }                                                                            \
+                                                                               \
+  static inline void name##_init(struct ring_struct *ring) {                   \
+    memset(ring->entry, 0, sizeof(ring->entry));                               \
+    ring->in_offs = 0;                                                         \
+    ring->out_offs = 0;                                                        \
+    ring->full = false;                                                        \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_is_full(const struct ring_struct *ring) {          \
+    return ring->full;                                                         \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_is_empty(const struct ring_struct *ring) {         \
+    return !ring->full && ring->in_offs == ring->out_offs;                     \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_count(const struct ring_struct *ring) {          \
+    if (ring->full) {                                                          \
+      return (capacity);                                                       \
+    }                                                                          \
+    return name##_wrap(ring->in_offs + (capacity)-ring->out_offs);             \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_push(struct ring_struct *ring,                    \
+                                  const type *item) {                          \
+    type *slot = &ring->entry[ring->in_offs];                                  \
+    *slot = *item;                                                             \
+    ring->in_offs = name##_wrap(ring->in_offs + 1);                            \
+    if (ring->full) {                                                          \
+      ring->out_offs = ring->in_offs;                                          \
+    } else if (ring->in_offs == ring->out_offs) {                              \
+      ring->full = true;                                                       \
+    }                                                                          \
+    return slot;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_pop(struct ring_struct *ring) {                   \
+    if (name##_is_empty(ring)) {                                               \
+      return NULL;                                                             \
+    }                                                                          \
+    type *slot = &ring->entry[ring->out_offs];                                 \
+    ring->out_offs = name##_wrap(ring->out_offs + 1);                          \
+    ring->full = false;                                                        \
+    return slot;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_peek(struct ring_struct *ring, size_t index) {    \
+    if (index >= name##_count(ring)) {                                         \
+      return NULL;                                                             \
+    }                                                                          \
+    return &ring->entry[name##_wrap(ring->out_offs + index)];                  \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_find(                                             \
+      struct ring_struct *ring, bool (*match)(const type *, void *),           \
+      void *context, size_t *index_rtn) {                                      \
+    const size_t count = name##_count(ring);                                   \
+    size_t slot = ring->out_offs;                                              \
+    for (size_t index = 0; index < count; index++) {                           \
+      if (match(&ring->entry[slot], context)) {                                \
+        *index_rtn = index;                                                    \
+        return &ring->entry[slot];                                             \
+      }                                                                        \
+      slot = name##_wrap(slot + 1);                                            \
+    }                                                                          \
+    return NULL;                                                               \
+  }
+
+/**
+ * Declares `struct name`, a ring of @param capacity elements of @param type,
+ * and generates its functions
+ */
+#define DEFINE_RING(name, type, capacity)                                      \
+  struct name {                                                                \
+    RING_FIELDS(type, capacity);                                               \
+  };                                                                           \
+  DEFINE_RING_FUNCTIONS(name, name, type, capacity)
+
+#endif /* AESD_RING_H */
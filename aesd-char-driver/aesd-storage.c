@@ -0,0 +1,163 @@
+/**
+ * @file aesd-storage.c
+ * @brief Page backed storage for the data of aesdchar entries
+ *
+ * The data of every entry in the circular buffer lives in a single ring
+ * allocated when the device is created. Adding an entry claims the next
+ * contiguous region of the ring and evicts whatever old entries overlapped it,
+ * so no allocation or free is made per entry.
+ *
+ * The ring is preceded by a header page describing the retained entries, and
+ * both can be mapped read-only into userspace. See aesd_mmap.h for the layout.
+ *
+ */
+
+#include <linux/build_bug.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+
+#include "aesd-storage.h"
+
+/**
+ * Allocates a ring of at least @param size bytes, rounded up to whole pages,
+ * and its header page for @param storage.
+ * @return 0 if successful
+ * @return -EINVAL if @param size is 0
+ * @return -ENOMEM if the ring could not be allocated
+ */
+int aesd_storage_init(struct aesd_storage *storage, size_t size) {
+  BUILD_BUG_ON(sizeof(struct aesd_mmap_header) > PAGE_SIZE);
+
+  memset(storage, 0, sizeof(struct aesd_storage));
+  if (size == 0) {
+    return -EINVAL;
+  }
+
+  storage->data_size = PAGE_ALIGN(size);
+
+  // vmalloc_user zeroes the pages and allows them to be mapped to userspace
+  storage->header = vmalloc_user(PAGE_SIZE + storage->data_size);
+  if (NULL == storage->header) {
+    return -ENOMEM;
+  }
+  storage->data = (char *)storage->header + PAGE_SIZE;
+
+  storage->header->magic = AESD_MMAP_MAGIC;
+  storage->header->version = AESD_MMAP_VERSION;
+  storage->header->data_offset = PAGE_SIZE;
+  storage->header->data_size = storage->data_size;
+
+  return 0;
+}
+
+/**
+ * Releases the ring of @param storage. Entries referencing it must no longer
+ * be used.
+ */
+void aesd_storage_free(struct aesd_storage *storage) {
+  vfree(storage->header);
+  memset(storage, 0, sizeof(struct aesd_storage));
+}
+
+/**
+ * Marks the header of @param storage as being updated. Must be called before
+ * the ring is modified so userspace readers discard anything they copy until
+ * the matching aesd_storage_write_end.
+ */
+void aesd_storage_write_begin(struct aesd_storage *storage) {
+  WRITE_ONCE(storage->header->sequence, storage->header->sequence + 1);
+  smp_wmb();
+}
+
+/**
+ * Describes the entries of @param buffer in the header of @param storage and
+ * completes the update started by aesd_storage_write_begin.
+ * @param committed_bytes total number of bytes committed to the device
+ */
+void aesd_storage_write_end(struct aesd_storage *storage,
+                            struct aesd_circular_buffer *buffer,
+                            loff_t committed_bytes) {
+  struct aesd_mmap_header *header = storage->header;
+
+  size_t index;
+  const struct aesd_buffer_entry *entry;
+  AESD_CIRCULAR_BUFFER_FOREACH_VALID(entry, buffer, index) {
+    header->entry[index].offset = entry->buffptr - storage->data;
+    header->entry[index].size = entry->size;
+  }
+  header->entry_count = index;
+  header->committed_bytes = committed_bytes;
+
+  smp_wmb();
+  WRITE_ONCE(header->sequence, header->sequence + 1);
+}
+
+/**
+ * Maps the header page and ring of @param storage read-only into @param vma.
+ * @return 0 if successful
+ * @return -EPERM if a writable mapping was requested
+ * @return -EINVAL if the mapping is larger than the storage
+ */
+int aesd_storage_mmap(struct aesd_storage *storage,
+                      struct vm_area_struct *vma) {
+  if (vma->vm_flags & VM_WRITE) {
+    return -EPERM;
+  }
+
+  // Also prevent mprotect from making the mapping writable later
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+  vm_flags_clear(vma, VM_MAYWRITE);
+#else
+  vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+  return remap_vmalloc_range(vma, storage->header, vma->vm_pgoff);
+}
+
+/**
+ * Claims @param size contiguous bytes of @param storage for a new entry of
+ * @param buffer. Entries are evicted from @param buffer, oldest first, until
+ * none of them overlap the claimed region. Any necessary locking must be
+ * performed by the caller.
+ * @return a pointer to the claimed region, or NULL if @param size is 0 or does
+ * not fit in the ring.
+ */
+char *aesd_storage_reserve(struct aesd_storage *storage,
+                           struct aesd_circular_buffer *buffer, size_t size) {
+  if ((size == 0) || (size > storage->data_size)) {
+    return NULL;
+  }
+
+  // Start over at the beginning whenever the ring is empty
+  if (aesd_circular_buffer_entry_count(buffer) == 0) {
+    storage->head = 0;
+  }
+
+  size_t offset = storage->head;
+  size_t claim_size = size;
+  if (offset + size > storage->data_size) {
+    // Not enough room before the end of the ring. The remainder is skipped,
+    // which also means the entries stored there must be evicted first.
+    claim_size += storage->data_size - offset;
+    offset = 0;
+  }
+
+  // Entries are stored in order, so the oldest entry is always the closest
+  // one after `head`.
+  const struct aesd_buffer_entry *oldest_entry;
+  while ((oldest_entry = aesd_circular_buffer_get_entry(buffer, 0)) != NULL) {
+    const size_t oldest_offset = oldest_entry->buffptr - storage->data;
+    const size_t distance =
+        (oldest_offset + storage->data_size - storage->head) %
+        storage->data_size;
+    if (distance >= claim_size) {
+      break;
+    }
+    aesd_circular_buffer_remove_entry(buffer);
+  }
+
+  storage->head = offset + size;
+  return storage->data + offset;
+}
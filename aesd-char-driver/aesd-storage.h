@@ -0,0 +1,52 @@
+/*
+ * aesd-storage.h
+ *
+ *  Preallocated ring of pages holding the data of aesdchar entries.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESD_STORAGE_H_
+#define AESD_CHAR_DRIVER_AESD_STORAGE_H_
+
+#include <linux/mm_types.h>
+#include <linux/types.h>
+#include "aesd-circular-buffer.h"
+#include "aesd_mmap.h"
+
+struct aesd_storage {
+  /**
+   * Page describing the retained entries to userspace, directly followed by
+   * `data` in the same allocation.
+   */
+  struct aesd_mmap_header *header;
+  /**
+   * Page backed ring holding the data of every entry in the circular buffer.
+   * Entries are stored contiguously in the order they were added.
+   */
+  char *data;
+  /**
+   * Number of bytes in `data`, a multiple of PAGE_SIZE.
+   */
+  size_t data_size;
+  /**
+   * Offset in `data` where the next entry will be placed.
+   */
+  size_t head;
+};
+
+int aesd_storage_init(struct aesd_storage *storage, size_t size);
+
+void aesd_storage_free(struct aesd_storage *storage);
+
+char *aesd_storage_reserve(struct aesd_storage *storage,
+                           struct aesd_circular_buffer *buffer, size_t size);
+
+void aesd_storage_write_begin(struct aesd_storage *storage);
+
+void aesd_storage_write_end(struct aesd_storage *storage,
+                            struct aesd_circular_buffer *buffer,
+                            loff_t committed_bytes);
+
+int aesd_storage_mmap(struct aesd_storage *storage,
+                      struct vm_area_struct *vma);
+
+#endif /* AESD_CHAR_DRIVER_AESD_STORAGE_H_ */
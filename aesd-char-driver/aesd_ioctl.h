@@ -0,0 +1,132 @@
+/*
+ * aesd_ioctl.h
+ *
+ *  @brief Definitions for the ioctls used on aesd char devices. Shared between
+ *  the driver and userspace consumers such as aesdsocket.
+ */
+
+#ifndef AESD_IOCTL_H
+#define AESD_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+// Pick an arbitrary unused value from
+// https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
+#define AESD_IOC_MAGIC 0x16
+
+// Command 1 is left for AESDCHAR_IOCSEEKTO as defined by the course tests
+
+/**
+ * Takes a pointer to a uint32_t. A non-zero value puts the file in follow
+ * mode: reads at the end of the data block until a new entry is written and
+ * poll only reports the file readable when there is unread data, giving
+ * `tail -f` semantics. The file position then counts every byte written since
+ * the device was created, so it stays valid as old entries are evicted.
+ * Writing zero switches back to the default mode, where the position is
+ * relative to the oldest entry and reads at the end return 0.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+
+/**
+ * Takes a pointer to a uint64_t byte budget for the sum of retained entry
+ * sizes, 0 for no limit beyond the storage size. The oldest entries are evicted
+ * right away if the retained entries exceed the new budget, and before each
+ * new entry as needed to fit it.
+ */
+#define AESDCHAR_IOCSMAXBYTES _IOW(AESD_IOC_MAGIC, 3, uint64_t)
+
+struct aesd_retention {
+  /**
+   * Byte budget set with AESDCHAR_IOCSMAXBYTES, 0 when unlimited
+   */
+  uint64_t max_bytes;
+  /**
+   * Sum of the sizes of the retained entries
+   */
+  uint64_t retained_bytes;
+  /**
+   * Bytes preallocated for entry data, the hard limit on retained_bytes
+   */
+  uint64_t storage_bytes;
+  uint32_t retained_entries;
+  uint32_t reserved;
+};
+
+/**
+ * Fills a struct aesd_retention describing what the device currently retains
+ */
+#define AESDCHAR_IOCGRETENTION _IOR(AESD_IOC_MAGIC, 4, struct aesd_retention)
+
+/**
+ * Entries are numbered in the order they are committed, starting at 0 when the
+ * device is created. A sequence number keeps referring to the same entry until
+ * it is evicted.
+ */
+struct aesd_info {
+  /**
+   * Sequence number of the oldest retained entry
+   */
+  uint64_t first_seq;
+  /**
+   * Sequence number the next committed entry will get. The newest retained
+   * entry is next_seq - 1 when entry_count is not 0.
+   */
+  uint64_t next_seq;
+  uint32_t entry_count;
+  uint32_t reserved;
+  /**
+   * Sizes of the retained entries, oldest first, entry_count of them are valid
+   */
+  uint64_t entry_size[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+/**
+ * Fills a struct aesd_info describing the retained entries
+ */
+#define AESDCHAR_IOCGINFO _IOR(AESD_IOC_MAGIC, 5, struct aesd_info)
+
+struct aesd_fetch {
+  /**
+   * In: sequence number of the first entry to copy
+   */
+  uint64_t seq;
+  /**
+   * In: user buffer the entries are copied to, back to back
+   */
+  uint64_t buf;
+  /**
+   * In: size of `buf`. Out: number of bytes copied, or the size of the first
+   * entry when it does not fit in `buf`.
+   */
+  uint64_t buf_size;
+  /**
+   * In: maximum number of entries to copy. Out: number of entries copied.
+   */
+  uint32_t count;
+  uint32_t reserved;
+};
+
+/**
+ * Copies up to `count` consecutive whole entries starting at `seq` into `buf`,
+ * stopping early at the newest entry or at the first entry that does not fit.
+ * Every entry ends with its '\n', so the copied entries can also be split on
+ * newlines.
+ * Fails with ENOENT if `seq` is not retained, either evicted or not written
+ * yet, and with ENOSPC if the first entry does not fit in `buf`.
+ */
+#define AESDCHAR_IOCFETCH _IOWR(AESD_IOC_MAGIC, 6, struct aesd_fetch)
+
+/**
+ * The maximum number of commands supported, used for bounds checking
+ */
+#define AESDCHAR_IOC_MAXNR 6
+
+#endif /* AESD_IOCTL_H */
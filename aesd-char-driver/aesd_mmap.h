@@ -0,0 +1,73 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only mapping of an aesd char device. Shared
+ *  between the driver and userspace consumers.
+ *
+ *  mmap() of the device maps a header page at offset 0, followed by the ring
+ *  holding the data of every retained entry at `data_offset`. The mapping can
+ *  not be made writable.
+ *
+ *  The header is protected by `sequence`, which is odd while the driver is
+ *  updating the header or the data ring. To take a consistent snapshot:
+ *    1. read `sequence`, retry if it is odd
+ *    2. read fence, then copy the entry descriptors and any entry data needed
+ *    3. read fence, then read `sequence` again, retry if it changed
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_MMAP_MAGIC (0x41455344) // "AESD"
+#define AESD_MMAP_VERSION (1)
+
+struct aesd_mmap_entry {
+  /**
+   * Offset of the entry data from the start of the data ring
+   */
+  uint64_t offset;
+  /**
+   * Number of bytes in the entry
+   */
+  uint64_t size;
+};
+
+struct aesd_mmap_header {
+  uint32_t magic;
+  uint32_t version;
+  /**
+   * Incremented before and after every update, odd while one is in progress
+   */
+  uint32_t sequence;
+  /**
+   * Number of valid descriptors in `entry`
+   */
+  uint32_t entry_count;
+  /**
+   * Offset of the data ring from the start of the mapping
+   */
+  uint64_t data_offset;
+  /**
+   * Number of bytes in the data ring
+   */
+  uint64_t data_size;
+  /**
+   * Total number of bytes committed since the device was created, see
+   * AESDCHAR_IOCFOLLOW
+   */
+  uint64_t committed_bytes;
+  /**
+   * Retained entries, oldest first
+   */
+  struct aesd_mmap_entry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+#endif /* AESD_MMAP_H */
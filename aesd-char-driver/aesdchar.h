@@ -8,11 +8,15 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
+#include <linux/atomic.h>
 #include <linux/cdev.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
 #include "aesd-circular-buffer.h"
+#include "aesd-storage.h"
 
-#define AESD_DEBUG 1 // Remove comment on this line to enable debug
+// #define AESD_DEBUG 1 // Remove comment on this line to enable debug
 
 #undef PDEBUG /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -27,14 +31,119 @@
 #define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Smallest allocation made for a staging buffer. Staging buffers double in
+ * size from here as a line is assembled.
+ */
+#define AESD_STAGING_MIN_CAPACITY (128)
+
+/**
+ * Per CPU counters of device activity, summed when the debugfs file
+ * aesdchar/aesdcharN is read.
+ */
+struct aesd_stats {
+  u64 bytes_written;
+  u64 entries_written;
+  u64 entries_evicted;
+  u64 bytes_read;
+  /**
+   * Number of entry lookups made for reads, and the number of those resumed
+   * from the read cursor of the file without a search
+   */
+  u64 lookups;
+  u64 cursor_hits;
+  u64 lock_acquisitions;
+  /**
+   * Number of acquisitions that had to wait for the device mutex, and the
+   * total time spent waiting
+   */
+  u64 lock_contentions;
+  u64 lock_wait_ns;
+};
+
 struct aesd_dev {
   /**
    * TODO: Add structure(s) and locks needed to complete assignment requirements
    */
   struct aesd_circular_buffer circular_buffer;
-  struct aesd_buffer_entry buffer_entry_staging;
+  /**
+   * Holds the data of every entry in `circular_buffer`.
+   */
+  struct aesd_storage storage;
+  /**
+   * Partial line left behind by a file released before it wrote a newline.
+   * It is prepended to the next committed line so a line split across
+   * separate opens still forms one entry. It is always shorter than the entry
+   * storage, and is dropped if it would make the next line too large.
+   */
+  struct aesd_buffer_entry buffer_entry_carryover;
+  /**
+   * Total number of bytes committed since the device was created, the end
+   * position for readers in follow mode.
+   */
+  loff_t committed_bytes;
+  /**
+   * Total number of entries committed since the device was created, the
+   * sequence number of the next entry.
+   */
+  u64 committed_entries;
+  /**
+   * Woken each time an entry is committed.
+   */
+  wait_queue_head_t read_queue;
+  /**
+   * Bytes written to files of this device that are not yet committed
+   */
+  atomic64_t staging_bytes;
+  struct aesd_stats __percpu *stats;
   struct mutex device_mutex;
   struct cdev cdev; /* Char device structure      */
 };
 
+/**
+ * Where the last read of a file stopped, so the next sequential read resumes
+ * without searching the circular buffer. Protected by the device mutex.
+ */
+struct aesd_read_cursor {
+  /**
+   * Buffer position, relative to the oldest entry, the cursor points at
+   */
+  loff_t pos;
+  /**
+   * Index of the entry holding `pos` after the oldest entry, and the offset of
+   * `pos` within it. `entry_offset` may equal the entry size when the read
+   * stopped at the end of an entry.
+   */
+  size_t entry_index;
+  size_t entry_offset;
+  /**
+   * Circular buffer generation the index was taken at
+   */
+  size_t generation;
+  bool valid;
+};
+
+/**
+ * Per open file state, stored in `filp->private_data`.
+ */
+struct aesd_file {
+  struct aesd_dev *device;
+  /**
+   * The line currently being assembled by writes to this file. Only the
+   * commit of a finished line into the circular buffer takes the device lock.
+   */
+  struct aesd_buffer_entry buffer_entry_staging;
+  /**
+   * Number of bytes allocated for `buffer_entry_staging.buffptr`.
+   */
+  size_t staging_capacity;
+  struct mutex staging_mutex;
+  /**
+   * True when reads at the end of the data block for new entries, see
+   * AESDCHAR_IOCFOLLOW.
+   */
+  bool follow;
+  struct aesd_read_cursor cursor;
+};
+
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
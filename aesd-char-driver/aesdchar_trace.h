@@ -0,0 +1,136 @@
+/*
+ * aesdchar_trace.h
+ *
+ *  Tracepoints for the AESD char driver, available under
+ *  /sys/kernel/tracing/events/aesdchar/ and to perf. They cost a static
+ *  branch when disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_) ||                          \
+    defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesd_open,
+            TP_PROTO(unsigned int minor, unsigned int f_flags),
+            TP_ARGS(minor, f_flags),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(unsigned int, f_flags)),
+            TP_fast_assign(__entry->minor = minor;
+                           __entry->f_flags = f_flags;),
+            TP_printk("minor=%u f_flags=0x%x", __entry->minor,
+                      __entry->f_flags));
+
+/**
+ * A read, `pos` is the file position it started at and `duration_ns` includes
+ * any time spent blocked in follow mode.
+ */
+TRACE_EVENT(aesd_read,
+            TP_PROTO(unsigned int minor, loff_t pos, size_t count,
+                     ssize_t result, u64 duration_ns),
+            TP_ARGS(minor, pos, count, result, duration_ns),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(loff_t, pos)
+                                 __field(size_t, count)
+                                 __field(ssize_t, result)
+                                 __field(u64, duration_ns)),
+            TP_fast_assign(__entry->minor = minor; __entry->pos = pos;
+                           __entry->count = count; __entry->result = result;
+                           __entry->duration_ns = duration_ns;),
+            TP_printk("minor=%u pos=%lld count=%zu result=%zd duration_ns=%llu",
+                      __entry->minor, __entry->pos, __entry->count,
+                      __entry->result, __entry->duration_ns));
+
+/**
+ * A write, `staged` is the size of the line being assembled by the file after
+ * the write, 0 if the write completed a line.
+ */
+TRACE_EVENT(aesd_write,
+            TP_PROTO(unsigned int minor, loff_t pos, size_t count,
+                     ssize_t result, size_t staged, u64 duration_ns),
+            TP_ARGS(minor, pos, count, result, staged, duration_ns),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(loff_t, pos)
+                                 __field(size_t, count)
+                                 __field(ssize_t, result)
+                                 __field(size_t, staged)
+                                 __field(u64, duration_ns)),
+            TP_fast_assign(__entry->minor = minor; __entry->pos = pos;
+                           __entry->count = count; __entry->result = result;
+                           __entry->staged = staged;
+                           __entry->duration_ns = duration_ns;),
+            TP_printk("minor=%u pos=%lld count=%zu result=%zd staged=%zu "
+                      "duration_ns=%llu",
+                      __entry->minor, __entry->pos, __entry->count,
+                      __entry->result, __entry->staged,
+                      __entry->duration_ns));
+
+/**
+ * A line committed to the circular buffer, `offset` is its offset in the
+ * storage ring.
+ */
+TRACE_EVENT(aesd_commit,
+            TP_PROTO(unsigned int minor, size_t size, size_t offset,
+                     size_t entries, size_t retained_bytes),
+            TP_ARGS(minor, size, offset, entries, retained_bytes),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(size_t, size)
+                                 __field(size_t, offset)
+                                 __field(size_t, entries)
+                                 __field(size_t, retained_bytes)),
+            TP_fast_assign(__entry->minor = minor; __entry->size = size;
+                           __entry->offset = offset;
+                           __entry->entries = entries;
+                           __entry->retained_bytes = retained_bytes;),
+            TP_printk("minor=%u size=%zu offset=%zu entries=%zu "
+                      "retained_bytes=%zu",
+                      __entry->minor, __entry->size, __entry->offset,
+                      __entry->entries, __entry->retained_bytes));
+
+/**
+ * Entries evicted to make room for a commit.
+ */
+TRACE_EVENT(aesd_evict,
+            TP_PROTO(unsigned int minor, size_t entries, size_t bytes),
+            TP_ARGS(minor, entries, bytes),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(size_t, entries)
+                                 __field(size_t, bytes)),
+            TP_fast_assign(__entry->minor = minor; __entry->entries = entries;
+                           __entry->bytes = bytes;),
+            TP_printk("minor=%u entries=%zu bytes=%zu", __entry->minor,
+                      __entry->entries, __entry->bytes));
+
+/**
+ * A search of the circular buffer for the entry holding `pos`.
+ */
+TRACE_EVENT(aesd_lookup,
+            TP_PROTO(unsigned int minor, size_t pos, bool found,
+                     size_t entry_offset, u64 duration_ns),
+            TP_ARGS(minor, pos, found, entry_offset, duration_ns),
+            TP_STRUCT__entry(__field(unsigned int, minor)
+                                 __field(size_t, pos)
+                                 __field(bool, found)
+                                 __field(size_t, entry_offset)
+                                 __field(u64, duration_ns)),
+            TP_fast_assign(__entry->minor = minor; __entry->pos = pos;
+                           __entry->found = found;
+                           __entry->entry_offset = entry_offset;
+                           __entry->duration_ns = duration_ns;),
+            TP_printk("minor=%u pos=%zu found=%d entry_offset=%zu "
+                      "duration_ns=%llu",
+                      __entry->minor, __entry->pos, __entry->found,
+                      __entry->entry_offset, __entry->duration_ns));
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,185 @@
+/**
+ * @file aesd-circular-buffer-bench.c
+ * @brief Microbenchmarks of the aesd circular buffer hot paths
+ *
+ * Usage: aesd-circular-buffer-bench [iterations]
+ *
+ * Measures aesd_circular_buffer_add_entry and
+ * aesd_circular_buffer_find_entry_offset_for_fpos for a range of buffer
+ * depths (entries held), entry sizes and access patterns, and writes the
+ * results to stdout as a JSON array with one object per measurement:
+ *
+ *   {"benchmark": "find", "pattern": "random", "depth": 10,
+ *    "entry_size": 256, "iterations": 1000000, "ns_per_op": 12.3}
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define BENCH_DEFAULT_ITERATIONS (1000000)
+#define BENCH_MAX_ENTRY_SIZE (4096)
+
+static const size_t entry_sizes[] = {16, 256, 4096};
+static const size_t depths[] = {1, 2, 5,
+                                AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED};
+
+static char entry_data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]
+                      [BENCH_MAX_ENTRY_SIZE];
+
+/**
+ * Consumed results, so the compiler can not drop the measured calls
+ */
+static volatile uintptr_t sink;
+
+/**
+ * Whether a result has been printed, to separate the JSON objects
+ */
+static int results_printed;
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief A xorshift generator, cheap enough not to dominate a lookup.
+ */
+static uint32_t next_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void report(const char *benchmark, const char *pattern, size_t depth,
+                   size_t entry_size, size_t iterations, uint64_t elapsed_ns) {
+  printf("%s\n  {\"benchmark\": \"%s\", \"pattern\": \"%s\", \"depth\": %zu, "
+         "\"entry_size\": %zu, \"iterations\": %zu, \"ns_per_op\": %.2f}",
+         results_printed ? "," : "", benchmark, pattern, depth, entry_size,
+         iterations, (double)elapsed_ns / (double)iterations);
+  results_printed = 1;
+}
+
+/**
+ * @brief Fills `buffer` with `depth` entries of `entry_size` bytes.
+ */
+static void fill_buffer(struct aesd_circular_buffer *buffer, size_t depth,
+                        size_t entry_size) {
+  aesd_circular_buffer_init(buffer);
+  for (size_t index = 0; index < depth; index++) {
+    struct aesd_buffer_entry entry = {.buffptr = entry_data[index],
+                                      .size = entry_size};
+    aesd_circular_buffer_add_entry(buffer, &entry);
+  }
+}
+
+/**
+ * @brief Measures adding entries to a buffer holding `depth` entries, keeping
+ * it at that depth by removing the oldest entry after each add. At the full
+ * depth no removal is needed, since the add overwrites the oldest entry.
+ */
+static void bench_add(size_t depth, size_t entry_size, size_t iterations) {
+  struct aesd_circular_buffer buffer;
+  fill_buffer(&buffer, depth, entry_size);
+  const int keep_depth = depth < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+  const uint64_t start_ns = now_ns();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    const size_t slot = iteration % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    struct aesd_buffer_entry entry = {.buffptr = entry_data[slot],
+                                      .size = entry_size};
+    sink += (uintptr_t)aesd_circular_buffer_add_entry(&buffer, &entry);
+    if (keep_depth) {
+      aesd_circular_buffer_remove_entry(&buffer);
+    }
+  }
+  report("add", keep_depth ? "add_remove" : "overwrite", depth, entry_size,
+         iterations, now_ns() - start_ns);
+}
+
+enum access_pattern { PATTERN_SEQUENTIAL, PATTERN_RANDOM, PATTERN_TAIL };
+
+static const char *const pattern_names[] = {"sequential", "random", "tail"};
+
+/**
+ * @brief Measures lookups of offsets chosen by `pattern` in a buffer holding
+ * `depth` entries of `entry_size` bytes: walking every offset in order, at
+ * random, or at random within the newest entry only.
+ */
+static void bench_find(enum access_pattern pattern, size_t depth,
+                       size_t entry_size, size_t iterations) {
+  struct aesd_circular_buffer buffer;
+  fill_buffer(&buffer, depth, entry_size);
+  const size_t total_size = depth * entry_size;
+
+  // Pick the offsets up front so only the lookup is measured
+  size_t *offsets = malloc(iterations * sizeof(size_t));
+  if (NULL == offsets) {
+    perror("malloc");
+    exit(1);
+  }
+  uint32_t random_state = 2463534242U;
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    switch (pattern) {
+    case PATTERN_SEQUENTIAL:
+      offsets[iteration] = iteration % total_size;
+      break;
+    case PATTERN_RANDOM:
+      offsets[iteration] = next_random(&random_state) % total_size;
+      break;
+    case PATTERN_TAIL:
+      offsets[iteration] = total_size - entry_size +
+                           next_random(&random_state) % entry_size;
+      break;
+    }
+  }
+
+  const uint64_t start_ns = now_ns();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    size_t entry_offset = 0;
+    sink += (uintptr_t)aesd_circular_buffer_find_entry_offset_for_fpos(
+        &buffer, offsets[iteration], &entry_offset);
+    sink += entry_offset;
+  }
+  report("find", pattern_names[pattern], depth, entry_size, iterations,
+         now_ns() - start_ns);
+  free(offsets);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = BENCH_DEFAULT_ITERATIONS;
+  if (argc > 1) {
+    iterations = strtoul(argv[1], NULL, 10);
+    if (iterations == 0) {
+      fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("[");
+  for (size_t size_index = 0;
+       size_index < sizeof(entry_sizes) / sizeof(entry_sizes[0]);
+       size_index++) {
+    for (size_t depth_index = 0;
+         depth_index < sizeof(depths) / sizeof(depths[0]); depth_index++) {
+      const size_t entry_size = entry_sizes[size_index];
+      const size_t depth = depths[depth_index];
+      bench_add(depth, entry_size, iterations);
+      bench_find(PATTERN_SEQUENTIAL, depth, entry_size, iterations);
+      bench_find(PATTERN_RANDOM, depth, entry_size, iterations);
+      bench_find(PATTERN_TAIL, depth, entry_size, iterations);
+    }
+  }
+  printf("\n]\n");
+
+  return 0;
+}
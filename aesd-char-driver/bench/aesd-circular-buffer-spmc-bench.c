@@ -0,0 +1,224 @@
+/**
+ * @file aesd-circular-buffer-spmc-bench.c
+ * @brief Throughput of the lock-free circular buffer against the mutex
+ * protected aesd circular buffer
+ *
+ * Usage: aesd-circular-buffer-spmc-bench [entries]
+ *
+ * One producer appends `entries` entries while 0 to 4 reader threads follow
+ * it. Each configuration runs once with aesd_spmc_buffer and once with an
+ * aesd_circular_buffer guarded by a pthread mutex, the way it is used today.
+ * Results are written to stdout as a JSON array with one object per run:
+ *
+ *   {"benchmark": "spmc", "readers": 2, "entry_size": 64,
+ *    "entries": 1000000, "producer_ns_per_op": 25.1,
+ *    "entries_read": 1834000, "entries_skipped": 166000}
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer-spmc.h"
+#include "aesd-circular-buffer.h"
+
+#define BENCH_DEFAULT_ENTRIES (1000000)
+#define BENCH_MAX_READERS (4)
+#define BENCH_MAX_ENTRY_SIZE (1024)
+
+static const size_t entry_sizes[] = {64, BENCH_MAX_ENTRY_SIZE};
+
+/**
+ * Whether a result has been printed, to separate the JSON objects
+ */
+static int results_printed;
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * The mutex protected baseline. Entries are copied into per slot storage so
+ * readers can copy them out under the lock, like the driver does.
+ */
+struct locked_buffer {
+  pthread_mutex_t lock;
+  struct aesd_circular_buffer buffer;
+  char data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED][BENCH_MAX_ENTRY_SIZE];
+  uint64_t head;
+};
+
+struct bench_run {
+  bool use_spmc;
+  struct aesd_spmc_buffer spmc;
+  struct locked_buffer *locked;
+  atomic_bool done;
+};
+
+struct bench_reader {
+  pthread_t thread;
+  struct bench_run *run;
+  uint64_t entries_read;
+  uint64_t entries_skipped;
+};
+
+static void locked_append(struct locked_buffer *locked, const char *data,
+                          size_t size) {
+  pthread_mutex_lock(&locked->lock);
+  char *slot = locked->data[locked->buffer.in_offs];
+  memcpy(slot, data, size);
+  struct aesd_buffer_entry entry = {.buffptr = slot, .size = size};
+  aesd_circular_buffer_add_entry(&locked->buffer, &entry);
+  locked->head++;
+  pthread_mutex_unlock(&locked->lock);
+}
+
+/**
+ * @brief Copies entry `*cursor` out of the locked buffer, skipping ahead when
+ * it was overwritten, with the same contract as aesd_spmc_buffer_read_next.
+ */
+static bool locked_read_next(struct locked_buffer *locked, uint64_t *cursor,
+                             char *out, uint64_t *skipped) {
+  bool found = false;
+  pthread_mutex_lock(&locked->lock);
+  const uint64_t count = aesd_circular_buffer_entry_count(&locked->buffer);
+  const uint64_t tail = locked->head - count;
+  if (*cursor < tail) {
+    *skipped += tail - *cursor;
+    *cursor = tail;
+  }
+  if (*cursor < locked->head) {
+    const struct aesd_buffer_entry *entry =
+        aesd_circular_buffer_get_entry(&locked->buffer, *cursor - tail);
+    memcpy(out, entry->buffptr, entry->size);
+    (*cursor)++;
+    found = true;
+  }
+  pthread_mutex_unlock(&locked->lock);
+  return found;
+}
+
+static void *reader_thread(void *arg) {
+  struct bench_reader *reader = arg;
+  struct bench_run *run = reader->run;
+  char out[BENCH_MAX_ENTRY_SIZE];
+  uint64_t cursor = 0;
+
+  while (!atomic_load_explicit(&run->done, memory_order_relaxed)) {
+    if (run->use_spmc) {
+      size_t size;
+      uint64_t skipped = 0;
+      if (aesd_spmc_buffer_read_next(&run->spmc, &cursor, out, sizeof(out),
+                                     &size, &skipped) == AESD_SPMC_OK) {
+        reader->entries_read++;
+      }
+      reader->entries_skipped += skipped;
+    } else if (locked_read_next(run->locked, &cursor, out,
+                                &reader->entries_skipped)) {
+      reader->entries_read++;
+    }
+  }
+  return NULL;
+}
+
+static void bench(bool use_spmc, size_t reader_count, size_t entry_size,
+                  size_t entries) {
+  struct bench_run run = {.use_spmc = use_spmc};
+  struct bench_reader readers[BENCH_MAX_READERS];
+  char entry[BENCH_MAX_ENTRY_SIZE];
+  memset(entry, 'a', entry_size);
+  atomic_init(&run.done, false);
+
+  if (use_spmc) {
+    if (aesd_spmc_buffer_init(&run.spmc,
+                              AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                              BENCH_MAX_ENTRY_SIZE)) {
+      perror("aesd_spmc_buffer_init");
+      exit(1);
+    }
+  } else {
+    run.locked = calloc(1, sizeof(struct locked_buffer));
+    if (NULL == run.locked) {
+      perror("calloc");
+      exit(1);
+    }
+    pthread_mutex_init(&run.locked->lock, NULL);
+  }
+
+  for (size_t index = 0; index < reader_count; index++) {
+    memset(&readers[index], 0, sizeof(readers[index]));
+    readers[index].run = &run;
+    pthread_create(&readers[index].thread, NULL, reader_thread,
+                   &readers[index]);
+  }
+
+  const uint64_t start_ns = now_ns();
+  for (size_t index = 0; index < entries; index++) {
+    if (use_spmc) {
+      aesd_spmc_buffer_append(&run.spmc, entry, entry_size);
+    } else {
+      locked_append(run.locked, entry, entry_size);
+    }
+  }
+  const uint64_t elapsed_ns = now_ns() - start_ns;
+
+  atomic_store(&run.done, true);
+  uint64_t entries_read = 0;
+  uint64_t entries_skipped = 0;
+  for (size_t index = 0; index < reader_count; index++) {
+    pthread_join(readers[index].thread, NULL);
+    entries_read += readers[index].entries_read;
+    entries_skipped += readers[index].entries_skipped;
+  }
+
+  printf("%s\n  {\"benchmark\": \"%s\", \"readers\": %zu, "
+         "\"entry_size\": %zu, \"entries\": %zu, "
+         "\"producer_ns_per_op\": %.2f, \"entries_read\": %llu, "
+         "\"entries_skipped\": %llu}",
+         results_printed ? "," : "", use_spmc ? "spmc" : "mutex",
+         reader_count, entry_size, entries,
+         (double)elapsed_ns / (double)entries,
+         (unsigned long long)entries_read,
+         (unsigned long long)entries_skipped);
+  results_printed = 1;
+
+  if (use_spmc) {
+    aesd_spmc_buffer_free(&run.spmc);
+  } else {
+    pthread_mutex_destroy(&run.locked->lock);
+    free(run.locked);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t entries = BENCH_DEFAULT_ENTRIES;
+  if (argc > 1) {
+    entries = strtoul(argv[1], NULL, 10);
+    if (entries == 0) {
+      fprintf(stderr, "Usage: %s [entries]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("[");
+  for (size_t size_index = 0;
+       size_index < sizeof(entry_sizes) / sizeof(entry_sizes[0]);
+       size_index++) {
+    for (size_t reader_count = 0; reader_count <= BENCH_MAX_READERS;
+         reader_count = reader_count ? reader_count * 2 : 1) {
+      bench(true, reader_count, entry_sizes[size_index], entries);
+      bench(false, reader_count, entry_sizes[size_index], entries);
+    }
+  }
+  printf("\n]\n");
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file bench.c
+ * @brief Microbenchmarks of the aesdchar read and write paths, run in
+ * userspace through the harness.
+ *
+ * Usage: aesdchar-bench [-s] [iterations]
+ *
+ * Each benchmark loads a fresh driver instance and prints one line per
+ * configuration with the mean cost per operation. With -s the contention
+ * benchmark also prints the debugfs statistics of the device after each
+ * configuration. The absolute numbers leave
+ * out the syscall and VFS overhead of a real kernel, so compare them between
+ * builds rather than against measurements on a target.
+ *
+ */
+
+#include <unistd.h>
+
+#include "harness.h"
+
+#include "aesd_ioctl.h"
+
+#define BENCH_DEFAULT_ITERATIONS (200000)
+#define BENCH_MAX_THREADS (8)
+
+static size_t iterations = BENCH_DEFAULT_ITERATIONS;
+static bool show_stats = false;
+
+/**
+ * @brief Fills `line` with `size` - 1 printable bytes and a newline.
+ */
+static void fill_line(char *line, size_t size) {
+  for (size_t index = 0; index < size - 1; index++) {
+    line[index] = 'a' + (index % 26);
+  }
+  line[size - 1] = '\n';
+}
+
+static void report(const char *name, const char *config, u64 elapsed_ns,
+                   size_t operations) {
+  printf("%-24s %-28s %10.1f ns/op\n", name, config,
+         (double)elapsed_ns / (double)operations);
+}
+
+/**
+ * @brief Checks that lines written in one call, split across calls and spread
+ * across iovec segments read back unchanged, before anything is measured.
+ * @return 0 if the driver behaved, -1 otherwise
+ */
+static int check_round_trip(void) {
+  static const char expected[] = "first\nsecond\nthird line\n";
+  char readback[sizeof(expected)] = {0};
+  int result = -1;
+
+  if (harness_load()) {
+    return -1;
+  }
+  struct harness_file *file = harness_open(0, O_RDWR);
+  if (NULL == file) {
+    harness_unload();
+    return -1;
+  }
+
+  struct iovec iov[] = {
+      {.iov_base = "first\nsec", .iov_len = 9},
+      {.iov_base = "ond\nthird", .iov_len = 9},
+  };
+  if (harness_writev(file, iov, 2) == 18 &&
+      harness_write(file, " line\n", 6) == 6) {
+    file->filp.f_pos = 0;
+    if (harness_read(file, readback, sizeof(readback)) ==
+            (ssize_t)(sizeof(expected) - 1) &&
+        memcmp(readback, expected, sizeof(expected) - 1) == 0) {
+      result = 0;
+    }
+  }
+
+  struct aesd_info info;
+  if (result == 0 && (harness_ioctl(file, AESDCHAR_IOCGINFO, &info) != 0 ||
+                      info.entry_count != 3)) {
+    result = -1;
+  }
+
+  harness_close(file);
+  harness_unload();
+  return result;
+}
+
+/**
+ * @brief Measures writes of whole lines of `line_size` bytes, each committing
+ * an entry, and of the same lines split over `pieces` writes.
+ */
+static void bench_write(size_t line_size, size_t pieces) {
+  char *line = malloc(line_size);
+  fill_line(line, line_size);
+  harness_load();
+  struct harness_file *file = harness_open(0, O_WRONLY);
+
+  const size_t piece_size = line_size / pieces;
+  const u64 start_ns = ktime_get_ns();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    size_t written = 0;
+    for (size_t piece = 1; piece < pieces; piece++) {
+      harness_write(file, line + written, piece_size);
+      written += piece_size;
+    }
+    harness_write(file, line + written, line_size - written);
+  }
+  const u64 elapsed_ns = ktime_get_ns() - start_ns;
+
+  char config[32];
+  snprintf(config, sizeof(config), "line=%zu pieces=%zu", line_size, pieces);
+  report("write", config, elapsed_ns, iterations * pieces);
+
+  harness_close(file);
+  harness_unload();
+  free(line);
+}
+
+/**
+ * @brief Measures sequential reads of `chunk_size` bytes through a full buffer
+ * of `line_size` byte entries, rewinding at the end of the data.
+ */
+static void bench_read(size_t line_size, size_t chunk_size) {
+  char *line = malloc(line_size);
+  char *chunk = malloc(chunk_size);
+  fill_line(line, line_size);
+  harness_load();
+  struct harness_file *file = harness_open(0, O_RDWR);
+  for (size_t entry = 0; entry < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+       entry++) {
+    harness_write(file, line, line_size);
+  }
+  file->filp.f_pos = 0;
+
+  const u64 start_ns = ktime_get_ns();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    if (harness_read(file, chunk, chunk_size) == 0) {
+      file->filp.f_pos = 0;
+    }
+  }
+  const u64 elapsed_ns = ktime_get_ns() - start_ns;
+
+  char config[32];
+  snprintf(config, sizeof(config), "line=%zu chunk=%zu", line_size,
+           chunk_size);
+  report("read sequential", config, elapsed_ns, iterations);
+
+  harness_close(file);
+  harness_unload();
+  free(chunk);
+  free(line);
+}
+
+/**
+ * @brief Measures one byte reads at the start of the entry `depth` entries
+ * after the oldest. Every read seeks back, so each one pays for a full search
+ * of the circular buffer.
+ */
+static void bench_lookup(size_t depth) {
+  char line[64];
+  char byte;
+  fill_line(line, sizeof(line));
+  harness_load();
+  struct harness_file *file = harness_open(0, O_RDWR);
+  for (size_t entry = 0; entry < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+       entry++) {
+    harness_write(file, line, sizeof(line));
+  }
+
+  const loff_t pos = depth * sizeof(line);
+  const u64 start_ns = ktime_get_ns();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    file->filp.f_pos = pos;
+    harness_read(file, &byte, 1);
+  }
+  const u64 elapsed_ns = ktime_get_ns() - start_ns;
+
+  char config[32];
+  snprintf(config, sizeof(config), "depth=%zu", depth);
+  report("read seek", config, elapsed_ns, iterations);
+
+  harness_close(file);
+  harness_unload();
+}
+
+struct contention_thread {
+  pthread_t thread;
+  struct harness_file *file;
+  size_t lines;
+};
+
+static void *contention_writer(void *arg) {
+  struct contention_thread *thread = arg;
+  char line[64];
+  fill_line(line, sizeof(line));
+  for (size_t index = 0; index < thread->lines; index++) {
+    harness_write(thread->file, line, sizeof(line));
+  }
+  return NULL;
+}
+
+/**
+ * @brief Measures the total throughput of `thread_count` threads writing
+ * lines to their own file of the same device, then prints the statistics of
+ * the device if requested.
+ */
+static void bench_contention(size_t thread_count) {
+  struct contention_thread threads[BENCH_MAX_THREADS];
+  harness_load();
+
+  for (size_t index = 0; index < thread_count; index++) {
+    threads[index].file = harness_open(0, O_WRONLY);
+    threads[index].lines = iterations / thread_count;
+  }
+
+  const u64 start_ns = ktime_get_ns();
+  for (size_t index = 0; index < thread_count; index++) {
+    pthread_create(&threads[index].thread, NULL, contention_writer,
+                   &threads[index]);
+  }
+  for (size_t index = 0; index < thread_count; index++) {
+    pthread_join(threads[index].thread, NULL);
+  }
+  const u64 elapsed_ns = ktime_get_ns() - start_ns;
+
+  char config[32];
+  snprintf(config, sizeof(config), "threads=%zu", thread_count);
+  report("write contended", config, elapsed_ns,
+         threads[0].lines * thread_count);
+  if (show_stats) {
+    harness_show_stats(0, stdout);
+  }
+
+  for (size_t index = 0; index < thread_count; index++) {
+    harness_close(threads[index].file);
+  }
+  harness_unload();
+}
+
+int main(int argc, char *argv[]) {
+  int option;
+  while ((option = getopt(argc, argv, "s")) != -1) {
+    if (option != 's') {
+      fprintf(stderr, "Usage: %s [-s] [iterations]\n", argv[0]);
+      return 1;
+    }
+    show_stats = true;
+  }
+
+  if (optind < argc) {
+    iterations = strtoul(argv[optind], NULL, 10);
+    if (iterations == 0) {
+      fprintf(stderr, "Usage: %s [-s] [iterations]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (check_round_trip()) {
+    fprintf(stderr, "Round trip check failed, not benchmarking\n");
+    return 1;
+  }
+
+  static const size_t line_sizes[] = {16, 256, 4096};
+  for (size_t index = 0; index < sizeof(line_sizes) / sizeof(line_sizes[0]);
+       index++) {
+    bench_write(line_sizes[index], 1);
+    bench_write(line_sizes[index], 8);
+  }
+
+  bench_read(256, 64);
+  bench_read(4096, 64);
+  bench_read(4096, 4096);
+
+  for (size_t depth = 0; depth < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+       depth++) {
+    bench_lookup(depth);
+  }
+
+  for (size_t thread_count = 1; thread_count <= BENCH_MAX_THREADS;
+       thread_count *= 2) {
+    bench_contention(thread_count);
+  }
+
+  return 0;
+}
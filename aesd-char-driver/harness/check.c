@@ -0,0 +1,228 @@
+/**
+ * @file check.c
+ * @brief Checks of the aesdchar write path edge cases, run in userspace
+ * through the harness.
+ *
+ * Usage: aesdchar-check
+ *
+ * Each check loads a fresh driver instance and prints its name with PASS or
+ * FAIL. The exit status is 0 only if every check passed.
+ *
+ */
+
+#include "harness.h"
+
+#include "aesd_ioctl.h"
+
+/**
+ * @brief Gets the size of the newest entry of the device `file` is open on
+ * @return the size, 0 if there is no entry
+ */
+static uint64_t newest_entry_size(struct harness_file *file) {
+  struct aesd_info info;
+  if (harness_ioctl(file, AESDCHAR_IOCGINFO, &info) != 0 ||
+      info.entry_count == 0) {
+    return 0;
+  }
+  return info.entry_size[info.entry_count - 1];
+}
+
+/**
+ * @brief Gets the size of the entry storage of the device `file` is open on,
+ * the longest line it can commit
+ */
+static size_t storage_size(struct harness_file *file) {
+  struct aesd_retention retention;
+  if (harness_ioctl(file, AESDCHAR_IOCGRETENTION, &retention) != 0) {
+    return 0;
+  }
+  return retention.storage_bytes;
+}
+
+/**
+ * @brief Checks that an unterminated line filling the entry storage is
+ * rejected and does not keep the file from writing valid lines, while one
+ * byte less is kept for its '\n'
+ * @return 0 if the driver behaved, -1 otherwise
+ */
+static int check_unterminated_full_line(void) {
+  int result = -1;
+  if (harness_load()) {
+    return -1;
+  }
+  struct harness_file *file = harness_open(0, O_RDWR);
+  if (NULL == file) {
+    harness_unload();
+    return -1;
+  }
+  const size_t size = storage_size(file);
+  char *line = malloc(size);
+  if (NULL == line || size == 0) {
+    goto out;
+  }
+  memset(line, 'x', size);
+
+  if (harness_write(file, line, size) != -EFBIG ||
+      harness_write(file, "y\n", 2) != 2 || newest_entry_size(file) != 2) {
+    goto out;
+  }
+
+  if (harness_write(file, line, size - 1) != (ssize_t)(size - 1) ||
+      harness_write(file, "\n", 1) != 1 || newest_entry_size(file) != size) {
+    goto out;
+  }
+  result = 0;
+
+out:
+  free(line);
+  harness_close(file);
+  harness_unload();
+  return result;
+}
+
+/**
+ * @brief Checks that a line carried over from a released file still completes
+ * the next line written to the device
+ * @return 0 if the driver behaved, -1 otherwise
+ */
+static int check_carryover_joins_next_line(void) {
+  char readback[16] = {0};
+  int result = -1;
+  if (harness_load()) {
+    return -1;
+  }
+  struct harness_file *first = harness_open(0, O_RDWR);
+  if (NULL == first) {
+    harness_unload();
+    return -1;
+  }
+  const bool staged = harness_write(first, "par", 3) == 3;
+  harness_close(first);
+
+  struct harness_file *second = harness_open(0, O_RDWR);
+  if (NULL == second) {
+    harness_unload();
+    return -1;
+  }
+  if (staged && harness_write(second, "tial\n", 5) == 5) {
+    second->filp.f_pos = 0;
+    if (harness_read(second, readback, sizeof(readback)) == 8 &&
+        memcmp(readback, "partial\n", 8) == 0) {
+      result = 0;
+    }
+  }
+
+  harness_close(second);
+  harness_unload();
+  return result;
+}
+
+/**
+ * @brief Checks that a carried over line too large to complete the next line
+ * is dropped, and the next writer's own line is committed alone
+ * @return 0 if the driver behaved, -1 otherwise
+ */
+static int check_carryover_too_large_for_next_line(void) {
+  int result = -1;
+  if (harness_load()) {
+    return -1;
+  }
+  struct harness_file *first = harness_open(0, O_RDWR);
+  if (NULL == first) {
+    harness_unload();
+    return -1;
+  }
+  const size_t size = storage_size(first);
+  char *line = malloc(size);
+  bool staged = false;
+  if (NULL != line && size != 0) {
+    memset(line, 'x', size);
+    staged = harness_write(first, line, size - 1) == (ssize_t)(size - 1);
+  }
+  harness_close(first);
+  free(line);
+
+  struct harness_file *second = harness_open(0, O_RDWR);
+  if (NULL == second) {
+    harness_unload();
+    return -1;
+  }
+  if (staged && harness_write(second, "hello\n", 6) == 6 &&
+      newest_entry_size(second) == 6) {
+    result = 0;
+  }
+
+  harness_close(second);
+  harness_unload();
+  return result;
+}
+
+/**
+ * @brief Checks that a file released with a partial line that would make the
+ * line already carried over too large drops its own partial line instead
+ * @return 0 if the driver behaved, -1 otherwise
+ */
+static int check_carryover_join_too_large(void) {
+  int result = -1;
+  if (harness_load()) {
+    return -1;
+  }
+  struct harness_file *files[3];
+  for (size_t index = 0; index < 3; index++) {
+    files[index] = harness_open(0, O_RDWR);
+    if (NULL == files[index]) {
+      while (index-- > 0) {
+        harness_close(files[index]);
+      }
+      harness_unload();
+      return -1;
+    }
+  }
+
+  const size_t size = storage_size(files[0]);
+  char *line = malloc(size);
+  bool staged = false;
+  if (NULL != line && size > 20) {
+    memset(line, 'x', size);
+    staged = harness_write(files[0], line, size - 10) == (ssize_t)(size - 10) &&
+             harness_write(files[1], line, 20) == 20;
+  }
+  free(line);
+  harness_close(files[0]);
+  harness_close(files[1]);
+
+  // Only the first partial line is carried over and completed
+  if (staged && harness_write(files[2], "\n", 1) == 1 &&
+      newest_entry_size(files[2]) == size - 9) {
+    result = 0;
+  }
+
+  harness_close(files[2]);
+  harness_unload();
+  return result;
+}
+
+struct check {
+  const char *name;
+  int (*run)(void);
+};
+
+int main(void) {
+  static const struct check checks[] = {
+      {"unterminated full line", check_unterminated_full_line},
+      {"carryover joins next line", check_carryover_joins_next_line},
+      {"carryover too large for line", check_carryover_too_large_for_next_line},
+      {"carryover join too large", check_carryover_join_too_large},
+  };
+
+  int status = 0;
+  for (size_t index = 0; index < sizeof(checks) / sizeof(checks[0]);
+       index++) {
+    const int result = checks[index].run();
+    printf("%-32s %s\n", checks[index].name, result ? "FAIL" : "PASS");
+    if (result) {
+      status = 1;
+    }
+  }
+  return status;
+}
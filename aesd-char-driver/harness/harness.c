@@ -0,0 +1,99 @@
+/**
+ * @file harness.c
+ * @brief Calls into the aesdchar file operations the way the VFS would
+ *
+ */
+
+#include "harness.h"
+
+#include "aesdchar.h"
+
+extern struct aesd_dev *aesd_devices;
+extern struct file_operations aesd_fops;
+
+/**
+ * Initializes the driver as module load would, with the default module
+ * parameters.
+ * @return 0 if successful, a negative errno otherwise
+ */
+int harness_load(void) { return kshim_module_init(); }
+
+void harness_unload(void) { kshim_module_exit(); }
+
+/**
+ * Opens device `minor` with `f_flags`.
+ * @return the open file, or NULL if the open failed
+ */
+struct harness_file *harness_open(unsigned int minor, unsigned int f_flags) {
+  struct harness_file *file = calloc(1, sizeof(struct harness_file));
+  if (NULL == file) {
+    return NULL;
+  }
+
+  file->inode.i_cdev = &aesd_devices[minor].cdev;
+  file->filp.f_flags = f_flags;
+  if (aesd_fops.open(&file->inode, &file->filp)) {
+    free(file);
+    return NULL;
+  }
+  return file;
+}
+
+/**
+ * Releases and frees `file`.
+ * @return the result of the release file operation
+ */
+int harness_close(struct harness_file *file) {
+  const int result = aesd_fops.release(&file->inode, &file->filp);
+  free(file);
+  return result;
+}
+
+/**
+ * Reads up to `count` bytes at the file position, as read(2) would.
+ */
+ssize_t harness_read(struct harness_file *file, void *buf, size_t count) {
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  struct iov_iter iter;
+  iov_iter_init(&iter, ITER_DEST, &iov, 1, count);
+
+  struct kiocb iocb = {.ki_filp = &file->filp, .ki_pos = file->filp.f_pos};
+  const ssize_t result = aesd_fops.read_iter(&iocb, &iter);
+  file->filp.f_pos = iocb.ki_pos;
+  return result;
+}
+
+/**
+ * Writes the `nr_segs` segments of `iov` at the file position, as writev(2)
+ * would.
+ */
+ssize_t harness_writev(struct harness_file *file, const struct iovec *iov,
+                       unsigned long nr_segs) {
+  size_t count = 0;
+  for (unsigned long index = 0; index < nr_segs; index++) {
+    count += iov[index].iov_len;
+  }
+  struct iov_iter iter;
+  iov_iter_init(&iter, ITER_SOURCE, iov, nr_segs, count);
+
+  struct kiocb iocb = {.ki_filp = &file->filp, .ki_pos = file->filp.f_pos};
+  const ssize_t result = aesd_fops.write_iter(&iocb, &iter);
+  file->filp.f_pos = iocb.ki_pos;
+  return result;
+}
+
+ssize_t harness_write(struct harness_file *file, const void *buf,
+                      size_t count) {
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+  return harness_writev(file, &iov, 1);
+}
+
+long harness_ioctl(struct harness_file *file, unsigned int cmd, void *arg) {
+  return aesd_fops.unlocked_ioctl(&file->filp, cmd, (unsigned long)arg);
+}
+
+int harness_show_stats(unsigned int minor, FILE *out) {
+  char name[16];
+  snprintf(name, sizeof(name), "aesdchar%u", minor);
+  return kshim_debugfs_show(name, out);
+}
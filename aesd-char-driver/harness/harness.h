@@ -0,0 +1,39 @@
+/*
+ * harness.h
+ *
+ *  Drives the aesdchar file operations from userspace, the way the VFS would
+ *  for open, read, write, ioctl and close on /dev/aesdcharN.
+ */
+
+#ifndef AESD_HARNESS_HARNESS_H_
+#define AESD_HARNESS_HARNESS_H_
+
+#include "kshim.h"
+
+/**
+ * An open aesdchar file
+ */
+struct harness_file {
+  struct inode inode;
+  struct file filp;
+};
+
+int harness_load(void);
+void harness_unload(void);
+
+struct harness_file *harness_open(unsigned int minor, unsigned int f_flags);
+int harness_close(struct harness_file *file);
+
+ssize_t harness_read(struct harness_file *file, void *buf, size_t count);
+ssize_t harness_write(struct harness_file *file, const void *buf,
+                      size_t count);
+ssize_t harness_writev(struct harness_file *file, const struct iovec *iov,
+                       unsigned long nr_segs);
+long harness_ioctl(struct harness_file *file, unsigned int cmd, void *arg);
+
+/**
+ * Prints the debugfs statistics of device `minor` to `out`.
+ */
+int harness_show_stats(unsigned int minor, FILE *out);
+
+#endif /* AESD_HARNESS_HARNESS_H_ */
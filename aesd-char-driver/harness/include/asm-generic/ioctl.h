@@ -0,0 +1,2 @@
+/* Use the userspace definitions of the ioctl number macros */
+#include_next <asm-generic/ioctl.h>
@@ -0,0 +1,329 @@
+/*
+ * kshim.h
+ *
+ *  Userspace stand-ins for the kernel APIs used by the aesdchar driver, so
+ *  main.c, aesd-storage.c and aesd-circular-buffer.c build unmodified as a
+ *  regular program. Every <linux/...> header the driver includes resolves to
+ *  this file. Only the behaviour the driver relies on is modelled: allocations
+ *  map to libc, mutexes and wait queues to pthreads, and user copies to memcpy.
+ */
+
+#ifndef AESD_HARNESS_KSHIM_H_
+#define AESD_HARNESS_KSHIM_H_
+
+#include <errno.h>
+#include <fcntl.h> // O_NONBLOCK
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h> // loff_t, ssize_t, dev_t
+#include <sys/uio.h>   // struct iovec
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef long long s64;
+
+#define __user
+#define __percpu
+#define __init
+#define __exit
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member)                                        \
+  ((type *)((char *)(ptr)-offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define BUILD_BUG_ON(condition) _Static_assert(!(condition), #condition)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#define ERESTARTSYS 512
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 6, 0)
+
+/* printk */
+#define KERN_DEBUG ""
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_ERR ""
+#define printk(fmt, args...) fprintf(stderr, fmt, ##args)
+
+/* module */
+struct module {
+  int unused;
+};
+extern struct module __this_module;
+#define THIS_MODULE (&__this_module)
+#define MODULE_AUTHOR(author)
+#define MODULE_LICENSE(license)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm)
+/* Give the harness a handle on the static init and exit functions */
+#define module_init(fn)                                                        \
+  int kshim_module_init(void) { return fn(); }
+#define module_exit(fn)                                                        \
+  void kshim_module_exit(void) { fn(); }
+int kshim_module_init(void);
+void kshim_module_exit(void);
+
+/* slab and vmalloc */
+typedef unsigned int gfp_t;
+#define GFP_KERNEL (0u)
+#define PAGE_SIZE (4096UL)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+static inline void *kmalloc(size_t size, gfp_t flags) { return malloc(size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags) {
+  return calloc(n, size);
+}
+static inline void *krealloc(const void *ptr, size_t size, gfp_t flags) {
+  return realloc((void *)ptr, size);
+}
+static inline void kfree(const void *ptr) { free((void *)ptr); }
+void *vmalloc_user(unsigned long size);
+static inline void vfree(const void *ptr) { free((void *)ptr); }
+
+/* uaccess, user memory is ordinary memory here */
+static inline unsigned long copy_to_user(void *to, const void *from,
+                                         unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+static inline unsigned long copy_from_user(void *to, const void *from,
+                                           unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+/* mutex */
+struct mutex {
+  pthread_mutex_t lock;
+};
+static inline void mutex_init(struct mutex *m) {
+  pthread_mutex_init(&m->lock, NULL);
+}
+static inline void mutex_destroy(struct mutex *m) {
+  pthread_mutex_destroy(&m->lock);
+}
+static inline void mutex_lock(struct mutex *m) { pthread_mutex_lock(&m->lock); }
+static inline int mutex_trylock(struct mutex *m) {
+  return pthread_mutex_trylock(&m->lock) == 0;
+}
+static inline void mutex_unlock(struct mutex *m) {
+  pthread_mutex_unlock(&m->lock);
+}
+
+/* wait queues */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} wait_queue_head_t;
+static inline void init_waitqueue_head(wait_queue_head_t *wq) {
+  pthread_mutex_init(&wq->lock, NULL);
+  pthread_cond_init(&wq->cond, NULL);
+}
+static inline void wake_up_interruptible(wait_queue_head_t *wq) {
+  pthread_mutex_lock(&wq->lock);
+  pthread_cond_broadcast(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+}
+/* Never interrupted, so always evaluates to 0 once `condition` holds */
+#define wait_event_interruptible(wq, condition)                                \
+  ({                                                                           \
+    pthread_mutex_lock(&(wq).lock);                                            \
+    while (!(condition)) {                                                     \
+      pthread_cond_wait(&(wq).cond, &(wq).lock);                               \
+    }                                                                          \
+    pthread_mutex_unlock(&(wq).lock);                                          \
+    0;                                                                         \
+  })
+
+/* atomics and per CPU data, a single copy shared by every thread */
+typedef struct {
+  long long counter;
+} atomic64_t;
+static inline void atomic64_set(atomic64_t *v, long long i) {
+  __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+static inline long long atomic64_read(const atomic64_t *v) {
+  return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+static inline void atomic64_add(long long i, atomic64_t *v) {
+  __atomic_fetch_add(&v->counter, i, __ATOMIC_RELAXED);
+}
+static inline void atomic64_sub(long long i, atomic64_t *v) {
+  __atomic_fetch_sub(&v->counter, i, __ATOMIC_RELAXED);
+}
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(var, val) __atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+
+/* ktime */
+u64 ktime_get_ns(void);
+
+/* char devices and files */
+#define MINORBITS 20
+#define MINORMASK ((1U << MINORBITS) - 1)
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev)&MINORMASK))
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+
+#define IOCB_NOWAIT (1 << 7)
+
+struct inode;
+struct file;
+struct kiocb;
+struct iov_iter;
+struct vm_area_struct;
+struct poll_table_struct;
+struct pipe_inode_info;
+typedef unsigned int __poll_t;
+
+struct file_operations {
+  struct module *owner;
+  ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+  ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+  __poll_t (*poll)(struct file *, struct poll_table_struct *);
+  long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+  long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+  int (*mmap)(struct file *, struct vm_area_struct *);
+  int (*open)(struct inode *, struct file *);
+  int (*release)(struct inode *, struct file *);
+  ssize_t (*splice_write)(struct pipe_inode_info *, struct file *, loff_t *,
+                          size_t, unsigned int);
+  ssize_t (*splice_read)(struct file *, loff_t *, struct pipe_inode_info *,
+                         size_t, unsigned int);
+};
+
+struct cdev {
+  struct module *owner;
+  const struct file_operations *ops;
+  dev_t dev;
+};
+
+struct inode {
+  struct cdev *i_cdev;
+  void *i_private;
+};
+
+struct file {
+  unsigned int f_flags;
+  loff_t f_pos;
+  void *private_data;
+};
+
+struct kiocb {
+  struct file *ki_filp;
+  loff_t ki_pos;
+  int ki_flags;
+};
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+static inline void cdev_del(struct cdev *cdev) {}
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name);
+static inline void unregister_chrdev_region(dev_t from, unsigned int count) {}
+
+long compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+ssize_t copy_splice_read(struct file *in, loff_t *ppos,
+                         struct pipe_inode_info *pipe, size_t len,
+                         unsigned int flags);
+ssize_t iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
+                               loff_t *ppos, size_t len, unsigned int flags);
+
+/* uio, an iterator over a plain iovec array */
+#define ITER_SOURCE 1
+#define ITER_DEST 0
+struct iov_iter {
+  const struct iovec *iov;
+  unsigned long nr_segs;
+  size_t iov_offset;
+  size_t count;
+};
+void iov_iter_init(struct iov_iter *i, unsigned int direction,
+                   const struct iovec *iov, unsigned long nr_segs,
+                   size_t count);
+static inline size_t iov_iter_count(const struct iov_iter *i) {
+  return i->count;
+}
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+
+/* poll */
+#define EPOLLIN (0x00000001)
+#define EPOLLOUT (0x00000004)
+#define EPOLLRDNORM (0x00000040)
+#define EPOLLWRNORM (0x00000100)
+static inline void poll_wait(struct file *filp, wait_queue_head_t *wq,
+                             struct poll_table_struct *p) {}
+
+/* mm, mapping is not supported */
+typedef unsigned long vm_flags_t;
+#define VM_WRITE (0x00000002)
+#define VM_MAYWRITE (0x00000020)
+struct vm_area_struct {
+  unsigned long vm_pgoff;
+  vm_flags_t vm_flags;
+};
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+                                  vm_flags_t flags) {
+  vma->vm_flags &= ~flags;
+}
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+                                      unsigned long pgoff) {
+  return -ENODEV;
+}
+
+/* seq_file and debugfs, show functions print to `out` */
+struct seq_file {
+  FILE *out;
+  void *private;
+};
+#define seq_printf(m, fmt, args...) fprintf((m)->out, fmt, ##args)
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+                void *data);
+#define DEFINE_SHOW_ATTRIBUTE(__name)                                          \
+  static int __name##_open(struct inode *inode, struct file *file) {           \
+    return single_open(file, __name##_show, inode->i_private);                 \
+  }                                                                            \
+  static const struct file_operations __name##_fops = {                        \
+      .owner = THIS_MODULE,                                                    \
+      .open = __name##_open,                                                   \
+  }
+struct dentry;
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, unsigned short mode,
+                                   struct dentry *parent, void *data,
+                                   const struct file_operations *fops);
+static inline void debugfs_remove_recursive(struct dentry *dentry) {}
+
+/**
+ * Prints the debugfs file `name` created by the driver to `out`.
+ * @return 0 if successful, -ENOENT if no such file was created
+ */
+int kshim_debugfs_show(const char *name, FILE *out);
+
+/* tracepoints compile to nothing */
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)                 \
+  static inline void trace_##name(proto) {}                                    \
+  static inline bool trace_##name##_enabled(void) { return false; }
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+
+#endif /* AESD_HARNESS_KSHIM_H_ */
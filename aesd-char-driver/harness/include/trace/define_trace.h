@@ -0,0 +1 @@
+/* Tracepoints are not created in the harness, see TRACE_EVENT in kshim.h */
@@ -0,0 +1,157 @@
+/**
+ * @file kshim.c
+ * @brief Userspace implementations of the kernel APIs declared in kshim.h
+ *
+ */
+
+#include "kshim.h"
+
+#include <time.h>
+
+struct module __this_module;
+
+void *vmalloc_user(unsigned long size) {
+  void *ptr = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+  if (NULL != ptr) {
+    memset(ptr, 0, PAGE_ALIGN(size));
+  }
+  return ptr;
+}
+
+u64 ktime_get_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops) {
+  memset(cdev, 0, sizeof(struct cdev));
+  cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count) {
+  cdev->dev = dev;
+  return 0;
+}
+
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name) {
+  // Any unused major will do
+  *dev = MKDEV(240U, baseminor);
+  return 0;
+}
+
+long compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+  return -ENOTTY;
+}
+
+ssize_t copy_splice_read(struct file *in, loff_t *ppos,
+                         struct pipe_inode_info *pipe, size_t len,
+                         unsigned int flags) {
+  return -EINVAL;
+}
+
+ssize_t iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
+                               loff_t *ppos, size_t len, unsigned int flags) {
+  return -EINVAL;
+}
+
+void iov_iter_init(struct iov_iter *i, unsigned int direction,
+                   const struct iovec *iov, unsigned long nr_segs,
+                   size_t count) {
+  i->iov = iov;
+  i->nr_segs = nr_segs;
+  i->iov_offset = 0;
+  i->count = count;
+}
+
+/**
+ * @brief Copies up to `bytes` between `addr` and the segments of `i`,
+ * advancing `i` past the copied bytes.
+ * @return the number of bytes copied
+ */
+static size_t iov_iter_copy(void *addr, size_t bytes, struct iov_iter *i,
+                            bool to_iter) {
+  size_t copied = 0;
+  bytes = min(bytes, i->count);
+  while (copied < bytes) {
+    const struct iovec *segment = i->iov;
+    const size_t chunk =
+        min(bytes - copied, segment->iov_len - i->iov_offset);
+    char *segment_ptr = (char *)segment->iov_base + i->iov_offset;
+    if (to_iter) {
+      memcpy(segment_ptr, (const char *)addr + copied, chunk);
+    } else {
+      memcpy((char *)addr + copied, segment_ptr, chunk);
+    }
+    copied += chunk;
+    i->count -= chunk;
+    i->iov_offset += chunk;
+    if (i->iov_offset == segment->iov_len) {
+      i->iov++;
+      i->nr_segs--;
+      i->iov_offset = 0;
+    }
+  }
+  return copied;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i) {
+  return iov_iter_copy((void *)addr, bytes, i, true);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i) {
+  return iov_iter_copy(addr, bytes, i, false);
+}
+
+/**
+ * The file being opened by kshim_debugfs_show, where single_open leaves the
+ * output stream.
+ */
+static FILE *debugfs_out;
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+                void *data) {
+  struct seq_file seq = {.out = debugfs_out, .private = data};
+  return show(&seq, NULL);
+}
+
+#define KSHIM_DEBUGFS_MAX_FILES (16)
+
+static struct kshim_debugfs_file {
+  char name[32];
+  void *data;
+  const struct file_operations *fops;
+} debugfs_files[KSHIM_DEBUGFS_MAX_FILES];
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent) {
+  return NULL;
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned short mode,
+                                   struct dentry *parent, void *data,
+                                   const struct file_operations *fops) {
+  for (size_t index = 0; index < KSHIM_DEBUGFS_MAX_FILES; index++) {
+    struct kshim_debugfs_file *file = &debugfs_files[index];
+    if (file->fops == NULL || strcmp(file->name, name) == 0) {
+      snprintf(file->name, sizeof(file->name), "%s", name);
+      file->data = data;
+      file->fops = fops;
+      break;
+    }
+  }
+  return NULL;
+}
+
+int kshim_debugfs_show(const char *name, FILE *out) {
+  for (size_t index = 0; index < KSHIM_DEBUGFS_MAX_FILES; index++) {
+    struct kshim_debugfs_file *file = &debugfs_files[index];
+    if (file->fops != NULL && strcmp(file->name, name) == 0) {
+      struct inode inode = {.i_private = file->data};
+      struct file filp = {0};
+      debugfs_out = out;
+      return file->fops->open(&inode, &filp);
+    }
+  }
+  return -ENOENT;
+}
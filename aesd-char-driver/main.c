@@ -12,199 +12,1034 @@
  */
 
 #include "aesdchar.h"
+#include "aesd_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "aesdchar_trace.h"
+
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h> // file_operations
 #include <linux/init.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
 #include <linux/printk.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/wait.h>
 int aesd_major = 0; // use dynamic major
 int aesd_minor = 0;
 
+static unsigned long aesd_storage_size = 1024 * 1024;
+module_param(aesd_storage_size, ulong, 0444);
+MODULE_PARM_DESC(aesd_storage_size,
+                 "Bytes preallocated for entry data, rounded up to pages");
+
+static unsigned long aesd_max_bytes = 0;
+module_param(aesd_max_bytes, ulong, 0444);
+MODULE_PARM_DESC(aesd_max_bytes,
+                 "Initial byte budget for retained entries, 0 for no limit");
+
+static unsigned int aesd_nr_devs = 1;
+module_param(aesd_nr_devs, uint, 0444);
+MODULE_PARM_DESC(aesd_nr_devs,
+                 "Number of devices, each with its own buffer and lock");
+
 MODULE_AUTHOR("Jack Center"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+/**
+ * Array of `aesd_nr_devs` independent devices, one per minor number.
+ */
+struct aesd_dev *aesd_devices;
+
+/**
+ * debugfs directory holding a statistics file for each device.
+ */
+static struct dentry *aesd_debugfs_dir;
 
 static int aesd_open(struct inode *inode, struct file *filp);
 static int aesd_release(struct inode *inode, struct file *filp);
-static ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                         loff_t *f_pos);
-static ssize_t aesd_write(struct file *filp, const char __user *buf,
-                          size_t count, loff_t *f_pos);
-static int aesd_setup_cdev(struct aesd_dev *dev);
+static ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static __poll_t aesd_poll(struct file *filp, struct poll_table_struct *wait);
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma);
+static long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd,
+                                unsigned long arg);
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index);
 static int aesd_init_module(void);
 static void aesd_cleanup_module(void);
 
 struct file_operations aesd_fops = {
     .owner = THIS_MODULE,
-    .read = aesd_read,
-    .write = aesd_write,
+    .read_iter = aesd_read_iter,
+    .write_iter = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
+    .poll = aesd_poll,
+    .mmap = aesd_mmap,
+    .unlocked_ioctl = aesd_unlocked_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
     .open = aesd_open,
     .release = aesd_release,
 };
 
+/**
+ * @brief returns the minor number of `dev_ptr`, used to tell devices apart in
+ * traces.
+ */
+static unsigned int aesd_dev_minor(const struct aesd_dev *dev_ptr) {
+  return MINOR(dev_ptr->cdev.dev);
+}
+
+/**
+ * @brief Locks the mutex of `dev_ptr`, accounting the time spent waiting for
+ * it in the device statistics when it is contended.
+ */
+static void aesd_lock_device(struct aesd_dev *dev_ptr) {
+  this_cpu_inc(dev_ptr->stats->lock_acquisitions);
+  if (mutex_trylock(&dev_ptr->device_mutex)) {
+    return;
+  }
+
+  const u64 wait_start_ns = ktime_get_ns();
+  mutex_lock(&dev_ptr->device_mutex);
+  this_cpu_inc(dev_ptr->stats->lock_contentions);
+  this_cpu_add(dev_ptr->stats->lock_wait_ns, ktime_get_ns() - wait_start_ns);
+}
+
 int aesd_open(struct inode *inode, struct file *filp) {
-  PDEBUG("open");
   // Retrive `aesd_dev` based on position of cdev
   struct aesd_dev *device = container_of(inode->i_cdev, struct aesd_dev, cdev);
+  trace_aesd_open(aesd_dev_minor(device), filp->f_flags);
 
-  // Set file `private_data` to our device structure pointer
-  filp->private_data = device;
+  struct aesd_file *file_ptr = kmalloc(sizeof(struct aesd_file), GFP_KERNEL);
+  if (NULL == file_ptr) {
+    return -ENOMEM;
+  }
+  file_ptr->device = device;
+  file_ptr->buffer_entry_staging.buffptr = NULL;
+  file_ptr->buffer_entry_staging.size = 0;
+  file_ptr->staging_capacity = 0;
+  file_ptr->follow = false;
+  file_ptr->cursor.valid = false;
+  mutex_init(&file_ptr->staging_mutex);
+
+  // Set file `private_data` to our per file structure pointer
+  filp->private_data = file_ptr;
 
   return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp) {
-  PDEBUG("release");
-  /**
-   * TODO: handle release (deallocate anything `aesd_open` allocated)
-   */
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_buffer_entry *staging = &file_ptr->buffer_entry_staging;
+
+  // Hand an unterminated line to the device so the next writer completes it
+  if (staging->size != 0) {
+    struct aesd_buffer_entry *carryover = &dev_ptr->buffer_entry_carryover;
+    aesd_lock_device(dev_ptr);
+    if (carryover->size + staging->size >= dev_ptr->storage.data_size) {
+      // Not even a '\n' would fit after it, it could never be committed
+      PDEBUG("Dropping %lu unterminated bytes", staging->size);
+      atomic64_sub(staging->size, &dev_ptr->staging_bytes);
+    } else if (carryover->size == 0) {
+      *carryover = *staging;
+      staging->buffptr = NULL;
+    } else {
+      char *joined = krealloc(carryover->buffptr,
+                              carryover->size + staging->size, GFP_KERNEL);
+      if (NULL == joined) {
+        PDEBUG("Dropping %lu unterminated bytes", staging->size);
+        atomic64_sub(staging->size, &dev_ptr->staging_bytes);
+      } else {
+        memcpy(joined + carryover->size, staging->buffptr, staging->size);
+        carryover->buffptr = joined;
+        carryover->size += staging->size;
+      }
+    }
+    mutex_unlock(&dev_ptr->device_mutex);
+  }
+
+  kfree(staging->buffptr);
+  mutex_destroy(&file_ptr->staging_mutex);
+  kfree(file_ptr);
   return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos) {
+/**
+ * @brief returns the number of bytes evicted from `dev_ptr` since it was
+ * created. The caller must hold the device mutex.
+ */
+static loff_t aesd_evicted_bytes(struct aesd_dev *dev_ptr) {
+  return dev_ptr->committed_bytes - dev_ptr->circular_buffer.total_size;
+}
 
-  PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
+/**
+ * @brief returns true if a follow mode reader at `f_pos` has data to read.
+ */
+static bool aesd_follow_has_data(struct aesd_dev *dev_ptr, loff_t f_pos) {
+  return READ_ONCE(dev_ptr->committed_bytes) > f_pos;
+}
 
-  struct aesd_dev *dev_ptr = (struct aesd_dev *)(filp->private_data);
-  mutex_lock(&dev_ptr->device_mutex);
+/**
+ * @brief Looks up the entry holding `buffer_pos` for a read of `file_ptr`,
+ * accounting the lookup in the device statistics. A read continuing where the
+ * previous one on the file stopped resumes from the file cursor in constant
+ * time; the circular buffer is only searched after a seek or once entries have
+ * been evicted since the cursor was set. The cursor is left pointing at
+ * `buffer_pos`. The caller must hold the device mutex.
+ */
+static const struct aesd_buffer_entry *
+aesd_lookup_entry(struct aesd_file *file_ptr, size_t buffer_pos,
+                  size_t *entry_offset_byte_rtn) {
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_read_cursor *cursor = &file_ptr->cursor;
+  this_cpu_inc(dev_ptr->stats->lookups);
 
-  size_t byte_rtn = 0;
+  if (cursor->valid && cursor->pos == buffer_pos &&
+      cursor->generation == dev_ptr->circular_buffer.generation) {
+    const struct aesd_buffer_entry *buffer_entry =
+        aesd_circular_buffer_get_entry(&dev_ptr->circular_buffer,
+                                       cursor->entry_index);
+    if (buffer_entry != NULL && cursor->entry_offset == buffer_entry->size) {
+      // The previous read finished this entry, move on to the next one
+      cursor->entry_index++;
+      cursor->entry_offset = 0;
+      buffer_entry = aesd_circular_buffer_get_entry(
+          &dev_ptr->circular_buffer, cursor->entry_index);
+    }
+    if (buffer_entry != NULL) {
+      this_cpu_inc(dev_ptr->stats->cursor_hits);
+      *entry_offset_byte_rtn = cursor->entry_offset;
+      return buffer_entry;
+    }
+    // At the end of the data, which the search below also handles
+  }
 
+  const u64 lookup_start_ns =
+      trace_aesd_lookup_enabled() ? ktime_get_ns() : 0;
+  size_t entry_index = 0;
   const struct aesd_buffer_entry *buffer_entry =
-      aesd_circular_buffer_find_entry_offset_for_fpos(
-          &(dev_ptr->circular_buffer), (size_t)(*f_pos), &byte_rtn);
-  if (buffer_entry == NULL) {
-    PDEBUG("No `buffer_entry` at the requested offset: %lu", (size_t)(*f_pos));
-    mutex_unlock(&dev_ptr->device_mutex);
-    return 0;
+      aesd_circular_buffer_find_entry_index_for_fpos(
+          &(dev_ptr->circular_buffer), buffer_pos, entry_offset_byte_rtn,
+          &entry_index);
+  if (trace_aesd_lookup_enabled()) {
+    trace_aesd_lookup(aesd_dev_minor(dev_ptr), buffer_pos,
+                      buffer_entry != NULL, *entry_offset_byte_rtn,
+                      ktime_get_ns() - lookup_start_ns);
   }
 
-  size_t bytes_to_copy = min(count, buffer_entry->size);
-  PDEBUG("Reading %lu bytes", bytes_to_copy);
+  cursor->valid = buffer_entry != NULL;
+  cursor->pos = buffer_pos;
+  cursor->entry_index = entry_index;
+  cursor->entry_offset = *entry_offset_byte_rtn;
+  cursor->generation = dev_ptr->circular_buffer.generation;
+  return buffer_entry;
+}
+
+/**
+ * @brief Moves the read cursor of `file_ptr` past `count` bytes just read from
+ * the entry it points at. The caller must hold the device mutex.
+ */
+static void aesd_advance_cursor(struct aesd_file *file_ptr, size_t count) {
+  file_ptr->cursor.pos += count;
+  file_ptr->cursor.entry_offset += count;
+}
 
-  const ssize_t bytes_not_written =
-      copy_to_user(buf, buffer_entry->buffptr, bytes_to_copy);
-  PDEBUG("Bytes not read: %lu", bytes_not_written);
+/**
+ * @brief Reads from the entries starting at `iocb->ki_pos` into `to`, see
+ * aesd_read_iter.
+ */
+static ssize_t aesd_do_read(struct kiocb *iocb, struct iov_iter *to) {
+  struct file *filp = iocb->ki_filp;
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  loff_t *f_pos = &iocb->ki_pos;
+  aesd_lock_device(dev_ptr);
 
-  const size_t bytes_written = bytes_to_copy - bytes_not_written;
-  *f_pos += bytes_written;
+  loff_t buffer_pos = *f_pos;
+  if (file_ptr->follow) {
+    // Block until an entry is committed past the end of the data
+    while (!aesd_follow_has_data(dev_ptr, *f_pos)) {
+      mutex_unlock(&dev_ptr->device_mutex);
+      if ((iocb->ki_flags & IOCB_NOWAIT) || (filp->f_flags & O_NONBLOCK)) {
+        return -EAGAIN;
+      }
+      if (wait_event_interruptible(dev_ptr->read_queue,
+                                   aesd_follow_has_data(dev_ptr, *f_pos))) {
+        return -ERESTARTSYS;
+      }
+      aesd_lock_device(dev_ptr);
+    }
+
+    // Skip anything evicted before this reader got to it
+    const loff_t evicted_bytes = aesd_evicted_bytes(dev_ptr);
+    if (*f_pos < evicted_bytes) {
+      PDEBUG("Reader fell behind, skipping %lld bytes", evicted_bytes - *f_pos);
+      *f_pos = evicted_bytes;
+    }
+    buffer_pos = *f_pos - evicted_bytes;
+  }
+
+  // Fill `to` from as many consecutive entries as it has room for, so vectored
+  // and spliced reads are not cut short at every entry boundary.
+  size_t bytes_read = 0;
+  bool faulted = false;
+  while (iov_iter_count(to) != 0) {
+    size_t byte_rtn = 0;
+    const struct aesd_buffer_entry *buffer_entry =
+        aesd_lookup_entry(file_ptr, (size_t)buffer_pos, &byte_rtn);
+    if (buffer_entry == NULL) {
+      break;
+    }
+
+    const size_t bytes_to_copy =
+        min(iov_iter_count(to), buffer_entry->size - byte_rtn);
+    const size_t bytes_copied =
+        copy_to_iter(buffer_entry->buffptr + byte_rtn, bytes_to_copy, to);
+    aesd_advance_cursor(file_ptr, bytes_copied);
+    bytes_read += bytes_copied;
+    buffer_pos += bytes_copied;
+    *f_pos += bytes_copied;
+    if (bytes_copied != bytes_to_copy) {
+      faulted = true;
+      break;
+    }
+  }
   mutex_unlock(&dev_ptr->device_mutex);
 
-  return bytes_written;
+  this_cpu_add(dev_ptr->stats->bytes_read, bytes_read);
+
+  if (bytes_read == 0 && faulted) {
+    return -EFAULT;
+  }
+
+  return bytes_read;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos) {
-  PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  const loff_t pos = iocb->ki_pos;
+  const size_t count = iov_iter_count(to);
+  const u64 start_ns = trace_aesd_read_enabled() ? ktime_get_ns() : 0;
 
-  struct aesd_dev *dev_ptr = (struct aesd_dev *)(filp->private_data);
-  mutex_lock(&dev_ptr->device_mutex);
+  const ssize_t result = aesd_do_read(iocb, to);
 
-  /** Allocate memory to store user data */
-  size_t staging_offset = 0;
-  if (dev_ptr->buffer_entry_staging.size == 0) {
-    PDEBUG("Allocating a new staging buffer");
-    dev_ptr->buffer_entry_staging.buffptr = kmalloc(count, GFP_KERNEL);
-    if (NULL == dev_ptr->buffer_entry_staging.buffptr) {
-      mutex_unlock(&dev_ptr->device_mutex);
-      return -ENOMEM; // Memory allocation failure
-    }
-    dev_ptr->buffer_entry_staging.size = count;
-  } else {
-    PDEBUG("Reallocating the staging buffer from %lu to %lu",
-           dev_ptr->buffer_entry_staging.size,
-           dev_ptr->buffer_entry_staging.size + count);
-    dev_ptr->buffer_entry_staging.buffptr =
-        krealloc(dev_ptr->buffer_entry_staging.buffptr,
-                 dev_ptr->buffer_entry_staging.size + count, GFP_KERNEL);
-    if (NULL == dev_ptr->buffer_entry_staging.buffptr) {
-      kfree(dev_ptr->buffer_entry_staging.buffptr);
-      mutex_unlock(&dev_ptr->device_mutex);
-      return -ENOMEM; // Memory allocation failure
+  if (trace_aesd_read_enabled()) {
+    struct aesd_file *file_ptr =
+        (struct aesd_file *)(iocb->ki_filp->private_data);
+    trace_aesd_read(aesd_dev_minor(file_ptr->device), pos, count, result,
+                    ktime_get_ns() - start_ns);
+  }
+  return result;
+}
+
+__poll_t aesd_poll(struct file *filp, struct poll_table_struct *wait) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+
+  // Writes never block
+  __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+  poll_wait(filp, &dev_ptr->read_queue, wait);
+
+  // Outside of follow mode a read at the end returns 0 right away, so the
+  // file is always readable like a regular file.
+  if (!file_ptr->follow || aesd_follow_has_data(dev_ptr, filp->f_pos)) {
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+
+  return mask;
+}
+
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma) {
+  PDEBUG("mmap %lu bytes at page %lu", vma->vm_end - vma->vm_start,
+         vma->vm_pgoff);
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+
+  // The storage is allocated for the lifetime of the device, so the mapping
+  // needs no reference to it.
+  return aesd_storage_mmap(&file_ptr->device->storage, vma);
+}
+
+/**
+ * @brief Switches `filp` in or out of follow mode, converting its file
+ * position between the relative and absolute forms.
+ * @return 0
+ */
+static long aesd_set_follow(struct file *filp, bool follow) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+
+  aesd_lock_device(dev_ptr);
+  const loff_t evicted_bytes = aesd_evicted_bytes(dev_ptr);
+  if (follow && !file_ptr->follow) {
+    filp->f_pos += evicted_bytes;
+  } else if (!follow && file_ptr->follow) {
+    filp->f_pos = max_t(loff_t, filp->f_pos - evicted_bytes, 0);
+  }
+  file_ptr->follow = follow;
+  mutex_unlock(&dev_ptr->device_mutex);
+
+  return 0;
+}
+
+/**
+ * @brief Sets the byte budget of the device of `filp`, evicting entries that
+ * no longer fit.
+ * @return 0
+ */
+static long aesd_set_max_bytes(struct file *filp, u64 max_bytes) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+
+  aesd_lock_device(dev_ptr);
+  aesd_storage_write_begin(&dev_ptr->storage);
+
+  const size_t entries_before =
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+  const size_t retained_bytes_before = dev_ptr->circular_buffer.total_size;
+  aesd_circular_buffer_set_max_size(&dev_ptr->circular_buffer, max_bytes);
+  const size_t entries_evicted =
+      entries_before -
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+
+  aesd_storage_write_end(&dev_ptr->storage, &dev_ptr->circular_buffer,
+                         dev_ptr->committed_bytes);
+
+  if (entries_evicted != 0) {
+    this_cpu_add(dev_ptr->stats->entries_evicted, entries_evicted);
+    trace_aesd_evict(aesd_dev_minor(dev_ptr), entries_evicted,
+                     retained_bytes_before -
+                         dev_ptr->circular_buffer.total_size);
+  }
+
+  mutex_unlock(&dev_ptr->device_mutex);
+  return 0;
+}
+
+/**
+ * @brief Copies a description of what the device of `filp` retains to
+ * `retention_ptr`.
+ * @return 0 if successful
+ * @return -EFAULT if `retention_ptr` could not be written
+ */
+static long aesd_get_retention(struct file *filp,
+                               struct aesd_retention __user *retention_ptr) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_retention retention;
+  memset(&retention, 0, sizeof(retention));
+
+  aesd_lock_device(dev_ptr);
+  retention.max_bytes = dev_ptr->circular_buffer.max_size;
+  retention.retained_bytes = dev_ptr->circular_buffer.total_size;
+  retention.storage_bytes = dev_ptr->storage.data_size;
+  retention.retained_entries =
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+  mutex_unlock(&dev_ptr->device_mutex);
+
+  if (copy_to_user(retention_ptr, &retention, sizeof(retention))) {
+    return -EFAULT;
+  }
+  return 0;
+}
+
+/**
+ * @brief returns the sequence number of the oldest entry of `dev_ptr`. The
+ * caller must hold the device mutex.
+ */
+static u64 aesd_first_seq(struct aesd_dev *dev_ptr) {
+  return dev_ptr->committed_entries -
+         aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+}
+
+/**
+ * @brief Copies a description of the entries of the device of `filp` to
+ * `info_ptr`.
+ * @return 0 if successful
+ * @return -EFAULT if `info_ptr` could not be written
+ */
+static long aesd_get_info(struct file *filp,
+                          struct aesd_info __user *info_ptr) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_info info;
+  const struct aesd_buffer_entry *entry;
+  size_t index;
+  memset(&info, 0, sizeof(info));
+
+  aesd_lock_device(dev_ptr);
+  info.first_seq = aesd_first_seq(dev_ptr);
+  info.next_seq = dev_ptr->committed_entries;
+  AESD_CIRCULAR_BUFFER_FOREACH_VALID(entry, &dev_ptr->circular_buffer, index) {
+    info.entry_size[index] = entry->size;
+  }
+  info.entry_count = index;
+  mutex_unlock(&dev_ptr->device_mutex);
+
+  if (copy_to_user(info_ptr, &info, sizeof(info))) {
+    return -EFAULT;
+  }
+  return 0;
+}
+
+/**
+ * @brief Copies whole entries by sequence number, see AESDCHAR_IOCFETCH.
+ * @return 0 if successful
+ * @return -EFAULT if `fetch_ptr` or the buffer it points to could not be
+ * accessed
+ * @return -ENOENT if the first requested entry is not retained
+ * @return -ENOSPC if the first requested entry does not fit in the buffer
+ */
+static long aesd_fetch_entries(struct file *filp,
+                               struct aesd_fetch __user *fetch_ptr) {
+  struct aesd_file *file_ptr = (struct aesd_file *)(filp->private_data);
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_fetch fetch;
+  long result = 0;
+
+  if (copy_from_user(&fetch, fetch_ptr, sizeof(fetch))) {
+    return -EFAULT;
+  }
+  char __user *buf = u64_to_user_ptr(fetch.buf);
+
+  aesd_lock_device(dev_ptr);
+
+  const u64 first_seq = aesd_first_seq(dev_ptr);
+  if (fetch.seq < first_seq || fetch.seq >= dev_ptr->committed_entries) {
+    mutex_unlock(&dev_ptr->device_mutex);
+    return -ENOENT;
+  }
+
+  size_t index = fetch.seq - first_seq;
+  uint32_t entries_copied = 0;
+  u64 bytes_copied = 0;
+  const struct aesd_buffer_entry *entry;
+  while (entries_copied < fetch.count &&
+         NULL != (entry = aesd_circular_buffer_get_entry(
+                      &dev_ptr->circular_buffer, index))) {
+    if (entry->size > fetch.buf_size - bytes_copied) {
+      if (entries_copied == 0) {
+        // Tell the caller how large a buffer it needs
+        bytes_copied = entry->size;
+        result = -ENOSPC;
+      }
+      break;
+    }
+    if (copy_to_user(buf + bytes_copied, entry->buffptr, entry->size)) {
+      result = -EFAULT;
+      break;
+    }
+    bytes_copied += entry->size;
+    entries_copied++;
+    index++;
+  }
+
+  mutex_unlock(&dev_ptr->device_mutex);
+
+  if (result == -EFAULT) {
+    return result;
+  }
+
+  if (result == 0) {
+    this_cpu_add(dev_ptr->stats->bytes_read, bytes_copied);
+  }
+  fetch.buf_size = bytes_copied;
+  fetch.count = entries_copied;
+  if (copy_to_user(fetch_ptr, &fetch, sizeof(fetch))) {
+    return -EFAULT;
+  }
+  return result;
+}
+
+long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd,
+                         unsigned long arg) {
+  PDEBUG("ioctl %u", cmd);
+
+  if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR) {
+    return -ENOTTY;
+  }
+
+  switch (cmd) {
+  case AESDCHAR_IOCFOLLOW: {
+    uint32_t follow;
+    if (copy_from_user(&follow, (const void __user *)arg, sizeof(follow))) {
+      return -EFAULT;
+    }
+    return aesd_set_follow(filp, follow != 0);
+  }
+  case AESDCHAR_IOCSMAXBYTES: {
+    uint64_t max_bytes;
+    if (copy_from_user(&max_bytes, (const void __user *)arg,
+                       sizeof(max_bytes))) {
+      return -EFAULT;
     }
-    staging_offset = dev_ptr->buffer_entry_staging.size;
-    dev_ptr->buffer_entry_staging.size += count;
+    return aesd_set_max_bytes(filp, max_bytes);
   }
-  PDEBUG("Staging buffer size: %lu", dev_ptr->buffer_entry_staging.size);
+  case AESDCHAR_IOCGRETENTION:
+    return aesd_get_retention(filp, (struct aesd_retention __user *)arg);
+  case AESDCHAR_IOCGINFO:
+    return aesd_get_info(filp, (struct aesd_info __user *)arg);
+  case AESDCHAR_IOCFETCH:
+    return aesd_fetch_entries(filp, (struct aesd_fetch __user *)arg);
+  default:
+    return -ENOTTY;
+  }
+}
+
+/**
+ * @brief Frees the line carried over from a released file of `dev_ptr`, if
+ * any. The caller must hold the device mutex.
+ * @return the size of the line freed
+ */
+static size_t aesd_free_carryover(struct aesd_dev *dev_ptr) {
+  struct aesd_buffer_entry *carryover = &dev_ptr->buffer_entry_carryover;
+  const size_t size = carryover->size;
+  kfree(carryover->buffptr);
+  carryover->buffptr = NULL;
+  carryover->size = 0;
+  return size;
+}
 
-  char *write_ptr = dev_ptr->buffer_entry_staging.buffptr + staging_offset;
+/**
+ * @brief Copies every complete line staged in `file_ptr` into the device entry
+ * storage and adds each one to the circular buffer as its own entry, under a
+ * single acquisition of the device mutex. Any line carried over from a
+ * released file is prepended to the first line, or dropped if the two would
+ * not fit in the entry storage together. A trailing partial line is moved to
+ * the start of the staging buffer, which is kept for the next write. The
+ * caller must hold the staging mutex of `file_ptr`.
+ * @param eol_offset offset in the staging buffer of the first '\n'
+ * @param committed_size set to the number of staged bytes committed
+ * @return 0 if successful
+ * @return -EFBIG if a line does not fit in the entry storage, the lines before
+ * it are committed and the staging buffer then starts with that line
+ */
+static int aesd_commit_staging(struct aesd_file *file_ptr, size_t eol_offset,
+                               size_t *committed_size) {
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_buffer_entry *staging = &file_ptr->buffer_entry_staging;
+  struct aesd_buffer_entry *carryover = &dev_ptr->buffer_entry_carryover;
+  int result = 0;
+
+  aesd_lock_device(dev_ptr);
+
+  aesd_storage_write_begin(&dev_ptr->storage);
+
+  const size_t entries_before =
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+  const size_t retained_bytes_before = dev_ptr->circular_buffer.total_size;
+  size_t carryover_released = 0;
+  size_t entries_committed = 0;
+  size_t bytes_committed = 0;
+  size_t line_start = 0;
+
+  const char *end_of_line_ptr = staging->buffptr + eol_offset;
+  while (NULL != end_of_line_ptr) {
+    const size_t line_end = end_of_line_ptr - staging->buffptr + 1;
+    const size_t line_size = line_end - line_start;
+
+    // The writer's own line is committed even if the carried over one would
+    // make it too large, that one is dropped instead
+    if (carryover->size + line_size > dev_ptr->storage.data_size) {
+      PDEBUG("Dropping a %lu byte carried over line", carryover->size);
+      carryover_released = aesd_free_carryover(dev_ptr);
+    }
+
+    struct aesd_buffer_entry entry;
+    entry.size = carryover->size + line_size;
+    entry.buffptr = aesd_storage_reserve(
+        &dev_ptr->storage, &dev_ptr->circular_buffer, entry.size);
+    if (NULL != entry.buffptr) {
+      if (carryover->size != 0) {
+        memcpy(entry.buffptr, carryover->buffptr, carryover->size);
+      }
+      memcpy(entry.buffptr + carryover->size, staging->buffptr + line_start,
+             line_size);
+      aesd_circular_buffer_add_entry(&(dev_ptr->circular_buffer), &entry);
+      dev_ptr->committed_bytes += entry.size;
+      dev_ptr->committed_entries++;
+      entries_committed++;
+      bytes_committed += entry.size;
+
+      trace_aesd_commit(
+          aesd_dev_minor(dev_ptr), entry.size,
+          entry.buffptr - dev_ptr->storage.data,
+          aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer),
+          dev_ptr->circular_buffer.total_size);
+    }
+
+    // Only the first line completes the carried over one
+    carryover_released += aesd_free_carryover(dev_ptr);
+
+    if (NULL == entry.buffptr) {
+      PDEBUG("A %lu byte line does not fit in storage", entry.size);
+      result = -EFBIG;
+      break;
+    }
+
+    line_start = line_end;
+    end_of_line_ptr = memchr(staging->buffptr + line_start, '\n',
+                             staging->size - line_start);
+  }
+
+  aesd_storage_write_end(&dev_ptr->storage, &dev_ptr->circular_buffer,
+                         dev_ptr->committed_bytes);
+
+  // Anything not accounted for by the new entries was evicted for them
+  const size_t entries_evicted =
+      entries_before + entries_committed -
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+  this_cpu_add(dev_ptr->stats->entries_written, entries_committed);
+  this_cpu_add(dev_ptr->stats->entries_evicted, entries_evicted);
+  if (entries_evicted != 0) {
+    trace_aesd_evict(aesd_dev_minor(dev_ptr), entries_evicted,
+                     retained_bytes_before + bytes_committed -
+                         dev_ptr->circular_buffer.total_size);
+  }
+
+  mutex_unlock(&dev_ptr->device_mutex);
+
+  atomic64_sub(carryover_released + line_start, &dev_ptr->staging_bytes);
+
+  if (entries_committed != 0) {
+    wake_up_interruptible(&dev_ptr->read_queue);
+  }
+
+  // Keep the trailing partial line, or the line that did not fit, staged
+  *committed_size = line_start;
+  staging->size -= line_start;
+  memmove(staging->buffptr, staging->buffptr + line_start, staging->size);
+
+  return result;
+}
+
+/**
+ * @brief Makes room for at least `count` more bytes in the staging buffer of
+ * `file_ptr`. The capacity grows geometrically so a line assembled from many
+ * small writes is copied a constant number of times per byte on average, up to
+ * the size of the device entry storage. The caller must hold the staging mutex
+ * of `file_ptr`.
+ * @return 0 if successful
+ * @return -ENOMEM if the buffer could not be grown, the staged data is kept
+ */
+static int aesd_staging_reserve(struct aesd_file *file_ptr, size_t count) {
+  struct aesd_buffer_entry *staging = &file_ptr->buffer_entry_staging;
+  const size_t required = staging->size + count;
+  if (required <= file_ptr->staging_capacity) {
+    return 0;
+  }
+
+  size_t capacity = max_t(size_t, file_ptr->staging_capacity * 2,
+                          AESD_STAGING_MIN_CAPACITY);
+  capacity = min(capacity, file_ptr->device->storage.data_size);
+  capacity = max(capacity, required);
+
+  PDEBUG("Growing the staging buffer from %lu to %lu",
+         file_ptr->staging_capacity, capacity);
+  char *buffptr = krealloc(staging->buffptr, capacity, GFP_KERNEL);
+  if (NULL == buffptr) {
+    return -ENOMEM; // Memory allocation failure
+  }
+
+  staging->buffptr = buffptr;
+  file_ptr->staging_capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Stages as much of `from` as the staging buffer can hold and commits
+ * the lines it completes. A staged line that reaches the device entry storage
+ * size without its '\n' can never be committed and is discarded, so the
+ * staging buffer always holds less than the entry storage size. The caller
+ * must hold the staging mutex of `file_ptr`.
+ * @param bytes_written number of bytes of the write consumed so far, updated
+ * with the bytes consumed from `from`. It never counts a byte of a line that
+ * does not fit in the entry storage.
+ * @return 0 if successful
+ * @return -EFBIG if a line does not fit in the entry storage, the lines before
+ * it are still committed
+ * @return -ENOMEM or -EFAULT if the data could not be staged
+ */
+static int aesd_stage_chunk(struct aesd_file *file_ptr, struct iov_iter *from,
+                            size_t *bytes_written) {
+  struct aesd_dev *dev_ptr = file_ptr->device;
+  struct aesd_buffer_entry *staging = &file_ptr->buffer_entry_staging;
+  const size_t staged_before = staging->size;
+  const size_t count =
+      min(iov_iter_count(from), dev_ptr->storage.data_size - staged_before);
+
+  /** Make room to store user data */
+  const int reserve_result = aesd_staging_reserve(file_ptr, count);
+  if (reserve_result) {
+    return reserve_result;
+  }
+
+  char *write_ptr = staging->buffptr + staged_before;
   /**
-   * If the return value from copy_from_user is less than 0, there was an error.
-   * Otherwise it is the number of bytes not copied.
+   * copy_from_iter gathers every segment of a vectored write and returns the
+   * number of bytes that could be copied.
    */
-  const ssize_t retval = copy_from_user(write_ptr, buf, count);
-  if (retval < 0) {
-    PDEBUG("`copy_from_user` returned %ld", retval);
-    kfree(dev_ptr->buffer_entry_staging.buffptr);
-    mutex_unlock(&dev_ptr->device_mutex);
-    return retval;
+  const size_t bytes_copied = copy_from_iter(write_ptr, count, from);
+  if (bytes_copied == 0) {
+    PDEBUG("`copy_from_iter` failed to copy %lu bytes", count);
+    return -EFAULT;
   }
 
-  const size_t bytes_copied = count - retval;
-  *f_pos += bytes_copied;
+  staging->size += bytes_copied;
+  atomic64_add(bytes_copied, &dev_ptr->staging_bytes);
 
-  // Only write if we have the line termination character
-  const char *end_of_line_ptr = memchr(write_ptr, '\n', count);
+  const char *end_of_line_ptr = memchr(write_ptr, '\n', bytes_copied);
   if (NULL == end_of_line_ptr) {
-    PDEBUG("Write is incomplete, the termination character was not found.");
-    mutex_unlock(&dev_ptr->device_mutex);
-    return bytes_copied;
+    if (staging->size < dev_ptr->storage.data_size) {
+      *bytes_written += bytes_copied;
+      return 0;
+    }
+
+    // Not even a '\n' would fit. None of the line counts as written, including
+    // what earlier chunks of this write staged.
+    PDEBUG("Discarding a %lu byte unterminated line", staging->size);
+    *bytes_written -= min(staged_before, *bytes_written);
+    atomic64_sub(staging->size, &dev_ptr->staging_bytes);
+    staging->size = 0;
+    return -EFBIG;
   }
 
-  const char *replaced_buffptr = aesd_circular_buffer_add_entry(
-      &(dev_ptr->circular_buffer), &(dev_ptr->buffer_entry_staging));
+  size_t committed_size;
+  if (0 == aesd_commit_staging(file_ptr, end_of_line_ptr - staging->buffptr,
+                               &committed_size)) {
+    *bytes_written += bytes_copied;
+    return 0;
+  }
+
+  // Unstage this write from the line that did not fit on
+  const size_t kept =
+      committed_size < staged_before ? staged_before - committed_size : 0;
+  const size_t unconsumed = staging->size - kept;
+  staging->size = kept;
+  atomic64_sub(unconsumed, &dev_ptr->staging_bytes);
+  *bytes_written += bytes_copied - unconsumed;
+  return -EFBIG;
+}
+
+/**
+ * @brief Stages the data in `from` and commits the lines it completes, see
+ * aesd_write_iter. A batch larger than the entry storage is staged in pieces,
+ * so it is accepted as long as each of its lines fits.
+ * @return the number of bytes consumed, short if a line does not fit, so a
+ * producer retrying the rest of the write never commits a line twice
+ * @return -EFBIG if the first line does not fit, nothing is committed
+ */
+static ssize_t aesd_do_write(struct kiocb *iocb, struct iov_iter *from) {
+  struct aesd_file *file_ptr =
+      (struct aesd_file *)(iocb->ki_filp->private_data);
+  int result = 0;
+  size_t bytes_written = 0;
+  mutex_lock(&file_ptr->staging_mutex);
 
-  if (NULL != replaced_buffptr) {
-    kfree(replaced_buffptr);
+  while (iov_iter_count(from) != 0) {
+    result = aesd_stage_chunk(file_ptr, from, &bytes_written);
+    if (result) {
+      break;
+    }
   }
 
-  // Clear the staging data
-  dev_ptr->buffer_entry_staging.buffptr = NULL;
-  dev_ptr->buffer_entry_staging.size = 0;
+  iocb->ki_pos += bytes_written;
+  this_cpu_add(file_ptr->device->stats->bytes_written, bytes_written);
+  mutex_unlock(&file_ptr->staging_mutex);
 
+  return bytes_written != 0 ? (ssize_t)bytes_written : result;
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  const loff_t pos = iocb->ki_pos;
+  const size_t count = iov_iter_count(from);
+  const u64 start_ns = trace_aesd_write_enabled() ? ktime_get_ns() : 0;
+
+  const ssize_t result = aesd_do_write(iocb, from);
+
+  if (trace_aesd_write_enabled()) {
+    struct aesd_file *file_ptr =
+        (struct aesd_file *)(iocb->ki_filp->private_data);
+    trace_aesd_write(aesd_dev_minor(file_ptr->device), pos, count, result,
+                     READ_ONCE(file_ptr->buffer_entry_staging.size),
+                     ktime_get_ns() - start_ns);
+  }
+  return result;
+}
+
+static int aesd_stats_show(struct seq_file *s, void *unused) {
+  struct aesd_dev *dev_ptr = (struct aesd_dev *)(s->private);
+  struct aesd_stats total;
+  memset(&total, 0, sizeof(total));
+
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    const struct aesd_stats *cpu_stats = per_cpu_ptr(dev_ptr->stats, cpu);
+    total.bytes_written += cpu_stats->bytes_written;
+    total.entries_written += cpu_stats->entries_written;
+    total.entries_evicted += cpu_stats->entries_evicted;
+    total.bytes_read += cpu_stats->bytes_read;
+    total.lookups += cpu_stats->lookups;
+    total.cursor_hits += cpu_stats->cursor_hits;
+    total.lock_acquisitions += cpu_stats->lock_acquisitions;
+    total.lock_contentions += cpu_stats->lock_contentions;
+    total.lock_wait_ns += cpu_stats->lock_wait_ns;
+  }
+
+  mutex_lock(&dev_ptr->device_mutex);
+  const size_t retained_entries =
+      aesd_circular_buffer_entry_count(&dev_ptr->circular_buffer);
+  const size_t retained_bytes = dev_ptr->circular_buffer.total_size;
+  const size_t max_bytes = dev_ptr->circular_buffer.max_size;
   mutex_unlock(&dev_ptr->device_mutex);
 
-  return bytes_copied;
+  seq_printf(s, "bytes_written %llu\n", total.bytes_written);
+  seq_printf(s, "entries_written %llu\n", total.entries_written);
+  seq_printf(s, "entries_evicted %llu\n", total.entries_evicted);
+  seq_printf(s, "bytes_read %llu\n", total.bytes_read);
+  seq_printf(s, "lookups %llu\n", total.lookups);
+  seq_printf(s, "cursor_hits %llu\n", total.cursor_hits);
+  seq_printf(s, "lock_acquisitions %llu\n", total.lock_acquisitions);
+  seq_printf(s, "lock_contentions %llu\n", total.lock_contentions);
+  seq_printf(s, "lock_wait_ns %llu\n", total.lock_wait_ns);
+  seq_printf(s, "staging_bytes %lld\n",
+             (long long)atomic64_read(&dev_ptr->staging_bytes));
+  seq_printf(s, "retained_entries %zu\n", retained_entries);
+  seq_printf(s, "retained_bytes %zu\n", retained_bytes);
+  seq_printf(s, "max_bytes %zu\n", max_bytes);
+  seq_printf(s, "storage_bytes %zu\n", dev_ptr->storage.data_size);
+  return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
 
-static int aesd_setup_cdev(struct aesd_dev *dev) {
-  PDEBUG("aesd_setup_cdev");
-  int err, devno = MKDEV(aesd_major, aesd_minor);
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index) {
+  PDEBUG("aesd_setup_cdev %u", index);
+  int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
   cdev_init(&dev->cdev, &aesd_fops);
   dev->cdev.owner = THIS_MODULE;
   dev->cdev.ops = &aesd_fops;
   err = cdev_add(&dev->cdev, devno, 1);
   if (err) {
-    printk(KERN_ERR "Error %d adding aesd cdev", err);
+    printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
   }
   return err;
 }
 
+/**
+ * @brief Initializes the circular buffer, locks and storage of `dev` and makes
+ * it available as minor `index`.
+ * @return 0 if successful
+ * @return a negative error code otherwise, nothing is left allocated
+ */
+static int aesd_init_device(struct aesd_dev *dev, unsigned int index) {
+  aesd_circular_buffer_init(&(dev->circular_buffer));
+  aesd_circular_buffer_set_max_size(&(dev->circular_buffer), aesd_max_bytes);
+  mutex_init(&(dev->device_mutex));
+  init_waitqueue_head(&(dev->read_queue));
+
+  atomic64_set(&(dev->staging_bytes), 0);
+
+  dev->stats = alloc_percpu(struct aesd_stats);
+  if (NULL == dev->stats) {
+    return -ENOMEM;
+  }
+
+  int result = aesd_storage_init(&(dev->storage), aesd_storage_size);
+  if (result) {
+    printk(KERN_ERR "Error %d allocating %lu bytes of aesd storage", result,
+           aesd_storage_size);
+    free_percpu(dev->stats);
+    return result;
+  }
+
+  result = aesd_setup_cdev(dev, index);
+  if (result) {
+    aesd_storage_free(&(dev->storage));
+    free_percpu(dev->stats);
+    return result;
+  }
+
+  // Statistics are optional, debugfs failures are not errors
+  char name[16];
+  snprintf(name, sizeof(name), "aesdchar%u", index);
+  debugfs_create_file(name, 0444, aesd_debugfs_dir, dev, &aesd_stats_fops);
+  return 0;
+}
+
+/**
+ * @brief Removes the first `count` devices and releases their memory.
+ */
+static void aesd_cleanup_devices(unsigned int count) {
+  unsigned int index;
+  for (index = 0; index < count; ++index) {
+    struct aesd_dev *dev = &aesd_devices[index];
+    cdev_del(&dev->cdev);
+
+    // Entries in the circular buffer all point into the storage ring
+    aesd_storage_free(&(dev->storage));
+    free_percpu(dev->stats);
+
+    if (dev->buffer_entry_carryover.buffptr != NULL) {
+      kfree(dev->buffer_entry_carryover.buffptr);
+    }
+  }
+}
+
 int aesd_init_module(void) {
   PDEBUG("aesd_init_module");
   dev_t dev = 0;
   int result;
-  result = alloc_chrdev_region(&dev, aesd_minor, 1, "aesdchar");
+
+  if (aesd_nr_devs == 0) {
+    printk(KERN_WARNING "aesd_nr_devs must be at least 1\n");
+    return -EINVAL;
+  }
+
+  result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs, "aesdchar");
   aesd_major = MAJOR(dev);
   if (result < 0) {
     printk(KERN_WARNING "Can't get major %d\n", aesd_major);
     return result;
   }
-  memset(&aesd_device, 0, sizeof(struct aesd_dev));
 
-  aesd_circular_buffer_init(&(aesd_device.circular_buffer));
-  mutex_init(&(aesd_device.device_mutex));
+  aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+  if (NULL == aesd_devices) {
+    unregister_chrdev_region(dev, aesd_nr_devs);
+    return -ENOMEM;
+  }
+
+  aesd_debugfs_dir = debugfs_create_dir("aesdchar", NULL);
 
-  result = aesd_setup_cdev(&aesd_device);
+  unsigned int index;
+  for (index = 0; index < aesd_nr_devs; ++index) {
+    result = aesd_init_device(&aesd_devices[index], index);
+    if (result) {
+      break;
+    }
+  }
 
   if (result) {
-    unregister_chrdev_region(dev, 1);
+    debugfs_remove_recursive(aesd_debugfs_dir);
+    aesd_cleanup_devices(index);
+    kfree(aesd_devices);
+    unregister_chrdev_region(dev, aesd_nr_devs);
   }
   return result;
 }
@@ -213,22 +1048,11 @@ void aesd_cleanup_module(void) {
   PDEBUG("aesd_cleanup_module");
   dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-  cdev_del(&aesd_device.cdev);
-
-  // Free any entries in the circular buffer.
-  uint8_t index;
-  struct aesd_buffer_entry *entry;
-  AESD_CIRCULAR_BUFFER_FOREACH(entry, &(aesd_device.circular_buffer), index) {
-    if (entry->buffptr != NULL) {
-      kfree(entry->buffptr);
-    }
-  }
-
-  if (aesd_device.buffer_entry_staging.buffptr != NULL) {
-    kfree(aesd_device.buffer_entry_staging.buffptr);
-  }
+  debugfs_remove_recursive(aesd_debugfs_dir);
+  aesd_cleanup_devices(aesd_nr_devs);
+  kfree(aesd_devices);
 
-  unregister_chrdev_region(devno, 1);
+  unregister_chrdev_region(devno, aesd_nr_devs);
 }
 
 module_init(aesd_init_module);
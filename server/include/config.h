@@ -4,6 +4,10 @@
 #define RESULT_FILE "/dev/aesdchar"
 #else
 #define RESULT_FILE "/var/tmp/aesdsocketdata"
+// Compressed segments of the older history
+#define COLD_HISTORY_FILE RESULT_FILE ".cold"
+// Payload of each packet when DEDUPLICATE_PACKETS is set
+#define PACKET_MAP_FILE RESULT_FILE ".map"
 #endif
 
 #define PORT "9000"
@@ -11,6 +15,23 @@
 #define BUFFER_SIZE (1024)
 #define TIMESTAMP_LOG_INTERVAL_S (10)
 
+// Packets queued for a subscriber that has not sent them yet
+#define SUBSCRIBER_QUEUE_DEPTH (64)
+// When a subscriber's queue is full, 1 disconnects it, 0 drops its oldest
+// queued packet instead
+#define SUBSCRIBER_DISCONNECT_WHEN_FULL (0)
+
+// Bytes of history compressed together, rounded up to a whole packet. Segments
+// up to PROTOCOL_MAX_FRAME_SIZE bytes are sent to compressed connections as is
+#define COLD_SEGMENT_SIZE (256 * 1024)
+// Bytes at the end of the history always kept uncompressed
+#define HOT_HISTORY_SIZE (1024 * 1024)
+// 1 stores identical packets once in file mode, 0 stores every copy
+#define DEDUPLICATE_PACKETS (0)
+// Compressed chunks of history cached for compressed connections, each
+// COMPRESSED_FRAME_SIZE bytes once decompressed
+#define COMPRESSED_CHUNK_CACHE_SIZE (32)
+
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdbool.h>
@@ -0,0 +1,47 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * A small LZ77 codec in the style of the LZ4 block format, without any
+ * dependency. Each block is compressed on its own. A block is a series of
+ * sequences, each a token byte, literals copied as is, then a match copied
+ * from earlier output. The last sequence only has literals.
+ *   token: high nibble literal count, low nibble match length - LZ_MIN_MATCH,
+ *          15 meaning bytes follow that add up to the rest, ending below 255
+ *   match: 2 byte little endian offset back from the current output position
+ */
+#define LZ_MIN_MATCH (4)
+
+/**
+ * @brief returns the largest size `length` bytes can compress to
+ */
+size_t lz_compress_bound(const size_t length);
+
+/**
+ * @brief Compresses `src` into `dst`
+ * @param src data to compress
+ * @param src_length size of `src`
+ * @param dst buffer for the compressed block
+ * @param dst_capacity size of `dst`
+ * @return the size of the compressed block
+ * @return 0 if it does not fit in `dst_capacity`
+ */
+size_t lz_compress(const char *src, const size_t src_length, char *dst,
+                   const size_t dst_capacity);
+
+/**
+ * @brief Decompresses the block `src` into `dst`. Safe on corrupt input.
+ * @param src compressed block
+ * @param src_length size of `src`
+ * @param dst buffer for the decompressed data
+ * @param dst_capacity size of `dst`
+ * @return the size of the decompressed data
+ * @return -1 if `src` is corrupt or does not fit in `dst_capacity`
+ */
+ssize_t lz_decompress(const char *src, const size_t src_length, char *dst,
+                      const size_t dst_capacity);
+
+#endif // LZ_H
@@ -0,0 +1,38 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * A packet received from a client. One packet is shared by every subscriber it
+ * is queued for, each holding a reference, and freed with its data when the
+ * last reference is released.
+ */
+struct packet {
+  atomic_uint refcount;
+  size_t length;
+  char *data;
+};
+
+/**
+ * @brief Creates a packet holding one reference
+ * @param data heap buffer holding the packet, owned by the packet from now on
+ * @param length size of the packet in bytes
+ * @return the packet if successful
+ * @return NULL if `data` is NULL or on error, `data` is freed
+ */
+struct packet *packet_create(char *data, const size_t length);
+
+/**
+ * @brief Takes another reference to `packet`
+ * @return `packet`
+ */
+struct packet *packet_get(struct packet *packet);
+
+/**
+ * @brief Releases a reference to `packet`, freeing it with the last one
+ */
+void packet_put(struct packet *packet);
+
+#endif // PACKET_H
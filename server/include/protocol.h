@@ -0,0 +1,95 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Commands are packets holding exactly one of these lines, where N, SEQ,
+ * OFFSET and LENGTH are decimal numbers. They are handled by the server
+ * instead of being appended to `RESULT_FILE`. A line that does not match a
+ * command exactly is stored like any other packet. Only `PROTOCOL_ACK_MODE`
+ * and `PROTOCOL_COMPRESS` may be followed by more data in the same packet.
+ */
+#define PROTOCOL_SUBSCRIBE "AESD_SUBSCRIBE"
+#define PROTOCOL_ACK_MODE "AESD_ACK_MODE"
+#define PROTOCOL_COMPRESS "AESD_COMPRESS"
+#define PROTOCOL_TAIL "AESD_TAIL:"   // AESD_TAIL:N
+#define PROTOCOL_SINCE "AESD_SINCE:" // AESD_SINCE:SEQ
+#define PROTOCOL_RANGE "AESD_RANGE:" // AESD_RANGE:OFFSET,LENGTH
+#define PROTOCOL_SEARCH "AESD_SEARCH:" // AESD_SEARCH:TEXT
+
+/**
+ * Starts the response to `COMMAND_TAIL` and `COMMAND_SINCE`, followed by the
+ * sequence number of the first packet sent and the number of packets, then a
+ * newline and the packets themselves
+ */
+#define PROTOCOL_PACKETS "AESD_PACKETS:"
+
+/**
+ * Acknowledges a packet stored in `COMMAND_ACK_MODE`, followed by its sequence
+ * number and a newline
+ */
+#define PROTOCOL_ACK "AESD_ACK:"
+
+/**
+ * The response to `COMMAND_SEARCH` has a line for each packet matching,
+ * `PROTOCOL_MATCH` then the sequence number of the packet, a ':' and the
+ * packet itself. It ends with `PROTOCOL_MATCHES` followed by the number of
+ * packets that matched and a newline.
+ */
+#define PROTOCOL_MATCH "AESD_MATCH:"
+#define PROTOCOL_MATCHES "AESD_MATCHES:"
+
+/**
+ * After `PROTOCOL_COMPRESS` the rest of the packet, or the next packet if
+ * there is none, is handled as usual but every byte of the response is sent in
+ * frames. A frame starts with two 32 bit big endian numbers, the size of its
+ * data once decompressed then the size of the data that follows. The data is a
+ * block compressed with `lz_compress`, or is sent as is when both sizes are
+ * equal. Neither size is ever larger than `PROTOCOL_MAX_FRAME_SIZE`, so a
+ * client can decompress every frame into a buffer of that size.
+ */
+#define PROTOCOL_FRAME_HEADER_SIZE (8)
+#define PROTOCOL_MAX_FRAME_SIZE (512 * 1024)
+
+typedef enum {
+  COMMAND_NONE,      // not a command, the packet is stored
+  COMMAND_SUBSCRIBE, // send the history then every new packet
+  COMMAND_TAIL,      // send the newest `count` packets
+  COMMAND_SINCE,     // send the packets from sequence number `seq` on
+  COMMAND_RANGE,     // send `length` bytes of the history from `offset`,
+                     // counted from the oldest retained entry on the device
+  COMMAND_ACK_MODE,  // store each following packet and only acknowledge it
+  COMMAND_SEARCH,    // send the packets containing `pattern`
+  COMMAND_COMPRESS,  // compress every response on the connection
+} CommandType;
+
+typedef struct {
+  CommandType type;
+  /**
+   * Size of the command line, including its newline
+   */
+  size_t line_length;
+  uint64_t count;
+  uint64_t seq;
+  uint64_t offset;
+  uint64_t length;
+  /**
+   * Points into the packet the command was parsed from, not null terminated
+   */
+  const char *pattern;
+  size_t pattern_length;
+} Command;
+
+/**
+ * @brief Recognises a command in the packet received from a client
+ * @param packet data received from the client, not null terminated
+ * @param length size of `packet`
+ * @param command pointer to the location to store the command, `type` is
+ * `COMMAND_NONE` if `packet` is not a command
+ */
+void protocol_parse_command(const char *packet, const size_t length,
+                            Command *command);
+
+#endif // PROTOCOL_H
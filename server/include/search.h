@@ -0,0 +1,19 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+/**
+ * @brief Finds the first occurrence of `needle` in `haystack`. Uses AVX2 when
+ * the CPU supports it, SSE2 on other x86 CPUs and a scalar search elsewhere.
+ * @param haystack data to search, not null terminated
+ * @param haystack_length size of `haystack`
+ * @param needle data to find, not null terminated
+ * @param needle_length size of `needle`, at least 1
+ * @return the first occurrence of `needle` in `haystack`
+ * @return NULL if there is none
+ */
+const char *search_find(const char *haystack, const size_t haystack_length,
+                        const char *needle, const size_t needle_length);
+
+#endif // SEARCH_H
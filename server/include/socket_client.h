@@ -1,8 +1,45 @@
 #ifndef SOCKET_CLIENT
 #define SOCKET_CLIENT
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
+#include "subscribers.h"
+
+/**
+ * A client connection and how responses are sent on it
+ */
+typedef struct {
+  int fd;
+  /**
+   * Set by `COMMAND_COMPRESS`, responses are then sent as compressed frames
+   */
+  bool is_compressed;
+  /**
+   * COMPRESSED_FRAME_SIZE bytes to compress frames into, allocated when the
+   * connection is compressed and freed with `socket_client_close_connection`
+   */
+  char *frame_buffer;
+} ClientConnection;
+
+/**
+ * Largest number of bytes compressed into one frame by
+ * `socket_client_send_line`
+ */
+#define COMPRESSED_FRAME_SIZE (65536)
+
+/**
+ * Data received on a connection carrying several packets that has not been
+ * handled yet
+ */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} ReceiveBuffer;
+
 /**
  * @brief Creates the client connection
  * @param server_fd server socket file descriptor
@@ -16,30 +53,94 @@ int socket_client_create_connection(const int server_fd, int *client_fd_ptr,
                                     const struct timespec *timeout);
 
 /**
- * @brief Receives data from client and writes to file
- * @param file file to send
- * @param client_fd client socket
+ * @brief Sends every later response on `client` as compressed frames
+ * @param client client connection
  * @return 0 if successful
  * @return -1 otherwise
  */
-int socket_client_receive_and_write_data(char *file, const int client_fd);
+int socket_client_enable_compression(ClientConnection *client);
 
 /**
- * @brief Sends the contents of `file` to the `client_fd` one line at a time
- * @param file file to send
+ * @brief Closes the `client` connection and frees what it holds
+ * @param client client connection
+ */
+void socket_client_close_connection(ClientConnection *client);
+
+/**
+ * @brief Receives one packet from the client into the heap. A packet ends with
+ * a newline or when the client stops sending.
  * @param client_fd client socket
+ * @param packet pointer to the location to store the packet, which the caller
+ * must free
+ * @param length pointer to the location to store the packet size
  * @return 0 if successful
+ * @return 1 if the client closed the connection without sending data
  * @return -1 otherwise
  */
-int socket_client_send_file(char *file, const int client_fd);
+int socket_client_receive_packet(const int client_fd, char **packet,
+                                 size_t *length);
 
 /**
- * @brief Sends the `line` to the `client_fd`
+ * @brief Receives from the client until `buffer` holds at least one complete
+ * line, then takes every complete line out of it. Checks for termination
+ * while waiting.
  * @param client_fd client socket
+ * @param buffer data received but not handled yet, initially empty or holding
+ * a heap buffer. The caller must free `buffer->data` once done.
+ * @param lines pointer to the location to store the complete lines, which the
+ * caller must free
+ * @param lines_length pointer to the location to store the size of `lines`
+ * @return 0 if successful
+ * @return 1 if the client closed the connection or termination was requested,
+ * `lines` then holds whatever was left in `buffer`, which may be nothing
+ * @return -1 otherwise
+ */
+int socket_client_receive_lines(const int client_fd, ReceiveBuffer *buffer,
+                                char **lines, size_t *lines_length);
+
+/**
+ * @brief Sends the contents of `file` to the `client` one line at a time
+ * @param file file to send
+ * @param client client connection
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int socket_client_send_file(char *file, const ClientConnection *client);
+
+/**
+ * @brief Sends the `line` to the `client`, compressed into frames of up to
+ * COMPRESSED_FRAME_SIZE bytes if the connection is compressed
+ * @param client client connection
  * @param line string to send to the client
  * @return 0 if successful
  * @return -1 otherwise
  */
-int socket_client_send_line(const int client_fd, char *line, const size_t length);
+int socket_client_send_line(const ClientConnection *client, char *line,
+                            const size_t length);
+
+/**
+ * @brief Sends a frame already compressed to a compressed `client`, see
+ * `PROTOCOL_COMPRESS`. Fails for frames larger than PROTOCOL_MAX_FRAME_SIZE.
+ * @param client client connection
+ * @param data frame data, compressed with `lz_compress` unless `length` equals
+ * `raw_length`
+ * @param length size of `data`
+ * @param raw_length size of the data once decompressed
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int socket_client_send_frame(const ClientConnection *client, const char *data,
+                             const size_t length, const size_t raw_length);
+
+/**
+ * @brief Sends each packet published to `subscriber` to the `client` until
+ * the client disconnects, falls too far behind or termination is requested
+ * @param client client connection
+ * @param subscriber subscriber registered for the client
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int socket_client_stream_packets(const ClientConnection *client,
+                                 struct subscriber *subscriber);
 
 #endif // SOCKET_CLIENT
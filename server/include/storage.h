@@ -0,0 +1,132 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "socket_client.h"
+
+/**
+ * Index of the packets stored in `RESULT_FILE`. Each line is a packet, numbered
+ * in the order it was appended starting at 0, so a client sending several
+ * lines at once stores several packets. A trailing line without its newline
+ * is not a packet until the rest of it is appended.
+ *
+ * In file mode the index is the file offset of every packet, kept in memory.
+ * With the aesd char device the driver is the index: only its retained
+ * entries are available, described by AESDCHAR_IOCGINFO and copied with
+ * AESDCHAR_IOCFETCH.
+ *
+ * In file mode the older history is compressed in the background: every
+ * COLD_SEGMENT_SIZE bytes that are more than HOT_HISTORY_SIZE bytes from the
+ * end move to `COLD_HISTORY_FILE` and leave a hole in `RESULT_FILE`, so the
+ * recent packets stay uncompressed and offsets don't change. The history is
+ * read back through this module, never from `RESULT_FILE` directly.
+ *
+ * History is immutable once written, so what is sent to compressed
+ * connections is compressed once: the cold segments are sent as the frames
+ * they already are, and the hot history is cached in compressed chunks.
+ *
+ * With DEDUPLICATE_PACKETS each distinct payload is stored once in
+ * `RESULT_FILE`, found by its FNV-1a hash and compared byte for byte, and
+ * `PACKET_MAP_FILE` holds one payload number per packet. Offsets and reads
+ * still refer to the history as it was sent, rebuilt from the payloads.
+ *
+ * Every function except `storage_scan` and `storage_compress_cold_history`
+ * must be called with the result file mutex held.
+ */
+
+/**
+ * Receives a run of whole packets from `storage_scan`
+ * @param packets the packets, each ending with its newline
+ * @param length size of `packets`
+ * @param first_seq sequence number of the first packet in `packets`
+ * @param context the context passed to `storage_scan`
+ * @return 0 to continue the scan, any other value to stop it
+ */
+typedef int (*StorageScanCallback)(const char *packets, const size_t length,
+                                   const uint64_t first_seq, void *context);
+
+/**
+ * @brief Builds the index of the packets already in `RESULT_FILE`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_init(void);
+
+/**
+ * @brief Releases the index
+ */
+void storage_free(void);
+
+/**
+ * @brief Appends `data` to `RESULT_FILE` and indexes the packets it completes
+ * @param data data to write
+ * @param length size of `data`
+ * @param next_seq_rtn pointer to the location to store the sequence number the
+ * next packet will get, so the packets completed by `data` end just before it.
+ * May be NULL.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_append(char *data, const size_t length, uint64_t *next_seq_rtn);
+
+/**
+ * @brief Gets the sequence numbers of the packets that can be sent
+ * @param first_seq_rtn pointer to the location to store the oldest packet
+ * @param next_seq_rtn pointer to the location to store the sequence number the
+ * next packet will get
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_get_bounds(uint64_t *first_seq_rtn, uint64_t *next_seq_rtn);
+
+/**
+ * @brief Sends `count` packets starting at `seq` to `client`. The packets
+ * must be within the bounds returned by `storage_get_bounds`.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_send_packets(const ClientConnection *client, const uint64_t seq,
+                         const uint64_t count);
+
+/**
+ * @brief Sends up to `length` bytes of the history starting at byte `offset`
+ * to `client`, nothing if `offset` is past the end. With the aesd char device
+ * offsets start at the oldest retained entry, so they shift whenever an entry
+ * is evicted.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_send_range(const ClientConnection *client, const uint64_t offset,
+                       uint64_t length);
+
+/**
+ * @brief Sends the whole history to `client`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int storage_send_history(const ClientConnection *client);
+
+/**
+ * @brief Compresses the oldest segment of the hot history, if it is due. Must
+ * be called without the result file mutex held, and from one thread only.
+ * @return 0 if a segment was compressed
+ * @return 1 if there was nothing to compress
+ * @return -1 otherwise
+ */
+int storage_compress_cold_history(void);
+
+/**
+ * @brief Passes the stored packets from `seq` to before `next_seq` to
+ * `callback`, oldest first, in runs of whole packets. Packets no longer stored
+ * are skipped. Must be called without the result file mutex held, it is only
+ * taken briefly so appends carry on during the scan.
+ * @return 0 if every packet was passed
+ * @return the value returned by `callback` if it stopped the scan
+ * @return -1 otherwise
+ */
+int storage_scan(uint64_t seq, uint64_t next_seq, StorageScanCallback callback,
+                 void *context);
+
+#endif // STORAGE_H
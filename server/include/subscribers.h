@@ -0,0 +1,83 @@
+#ifndef SUBSCRIBERS_H
+#define SUBSCRIBERS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "../../aesd-char-driver/aesd-ring.h"
+#include "config.h"
+#include "packet.h"
+#include "queue.h"
+
+// A pointer element type needs a typedef to be qualified correctly by the ring
+typedef struct packet *PacketRef;
+DEFINE_RING(packet_ring, PacketRef, SUBSCRIBER_QUEUE_DEPTH)
+
+/**
+ * A client streaming every packet appended after it subscribed. Publishing
+ * only queues a reference to the shared packet, the client's own thread sends
+ * it, so a slow client never holds up the others.
+ */
+struct subscriber {
+  int client_fd;
+  pthread_mutex_t mutex;
+  pthread_cond_t packet_queued;
+  /**
+   * Packets published but not yet taken by the client's thread
+   */
+  struct packet_ring queue;
+  /**
+   * Number of packets dropped because the queue was full
+   */
+  size_t dropped;
+  /**
+   * Set when the queue overflowed and SUBSCRIBER_DISCONNECT_WHEN_FULL is set
+   */
+  bool disconnected;
+  LIST_ENTRY(subscriber) subscribers;
+};
+
+/**
+ * @brief Initializes `subscriber` for the client `client_fd`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+int subscriber_init(struct subscriber *subscriber, const int client_fd);
+
+/**
+ * @brief Releases the packets still queued for `subscriber`. It must have
+ * been removed with `subscribers_remove` first.
+ */
+void subscriber_destroy(struct subscriber *subscriber);
+
+/**
+ * @brief Waits until a packet is queued for `subscriber` and takes it
+ * @param packet pointer to the location to store the packet, the caller must
+ * release it with `packet_put`
+ * @param timeout maximum time to wait
+ * @return 0 if a packet was taken
+ * @return 1 if the timeout elapsed
+ * @return -1 if the subscriber was disconnected for falling behind
+ */
+int subscriber_wait(struct subscriber *subscriber, struct packet **packet,
+                    const struct timespec *timeout);
+
+/**
+ * @brief Adds `subscriber` to the subscribers receiving published packets
+ */
+void subscribers_add(struct subscriber *subscriber);
+
+/**
+ * @brief Stops publishing packets to `subscriber`
+ */
+void subscribers_remove(struct subscriber *subscriber);
+
+/**
+ * @brief Queues a reference to `packet` for every subscriber. Must be called in
+ * the order packets are appended to `RESULT_FILE`.
+ */
+void subscribers_publish(struct packet *packet);
+
+#endif // SUBSCRIBERS_H
@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 
@@ -37,6 +38,29 @@ struct head_s {
  */
 int append_to_file(const char *file, char *buffer, const size_t buffer_len);
 
+/**
+ * @brief Counts the newlines in `data`
+ * @param data data to count, not null terminated
+ * @param length size of `data`
+ * @return the number of '\n' in `data`
+ */
+size_t count_newlines(const char *data, const size_t length);
+
+/**
+ * The hash of no data, to start `fnv1a_hash` with
+ */
+#define FNV1A_OFFSET_BASIS (14695981039346656037ULL)
+
+/**
+ * @brief Continues the 64 bit FNV-1a hash `hash` over `data`, so data in
+ * several pieces hashes as if it were contiguous
+ * @param hash hash of the data before `data`, FNV1A_OFFSET_BASIS for none
+ * @param data data to hash
+ * @param length size of `data`
+ * @return the hash including `data`
+ */
+uint64_t fnv1a_hash(uint64_t hash, const char *data, const size_t length);
+
 /**
  * @brief Sets up the daemon to run the program
  * @return 0 if successful (in daemon process)
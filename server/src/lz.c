@@ -0,0 +1,197 @@
+#include "lz.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define LZ_HASH_BITS (12)
+#define LZ_MAX_OFFSET (65535)
+
+/**
+ * @brief returns the hash table slot for the LZ_MIN_MATCH bytes at `data`
+ */
+static uint32_t hash_sequence(const char *data) {
+  uint32_t sequence;
+  memcpy(&sequence, data, sizeof(sequence));
+  return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Writes the rest of a length that did not fit in its token nibble
+ * @return the position after the length, or NULL if it does not fit
+ */
+static char *write_length(char *out, const char *out_end, size_t length) {
+  for (; length >= 255; length -= 255) {
+    if (out == out_end) {
+      return NULL;
+    }
+    *out++ = (char)255;
+  }
+  if (out == out_end) {
+    return NULL;
+  }
+  *out++ = (char)length;
+  return out;
+}
+
+/**
+ * @brief Reads the rest of a length whose token nibble was 15
+ * @return the position after the length, or NULL if `in` ends first
+ */
+static const char *read_length(const char *in, const char *in_end,
+                               size_t *length) {
+  uint8_t byte;
+  do {
+    if (in == in_end) {
+      return NULL;
+    }
+    byte = (uint8_t)*in++;
+    *length += byte;
+  } while (byte == 255);
+  return in;
+}
+
+/**
+ * @brief Writes a sequence of `literal_count` literals followed, unless
+ * `match_length` is 0, by a match
+ * @return the position after the sequence, or NULL if it does not fit
+ */
+static char *write_sequence(char *out, const char *out_end,
+                            const char *literals, const size_t literal_count,
+                            const size_t offset, const size_t match_length) {
+  if (out == out_end) {
+    return NULL;
+  }
+  char *token = out++;
+  const size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+  *token = (char)(((literal_count < 15 ? literal_count : 15) << 4) |
+                  (match_code < 15 ? match_code : 15));
+
+  if ((literal_count >= 15) &&
+      ((out = write_length(out, out_end, literal_count - 15)) == NULL)) {
+    return NULL;
+  }
+  if ((size_t)(out_end - out) < literal_count) {
+    return NULL;
+  }
+  memcpy(out, literals, literal_count);
+  out += literal_count;
+
+  if (match_length == 0) {
+    return out;
+  }
+  if (out_end - out < 2) {
+    return NULL;
+  }
+  *out++ = (char)(offset & 0xff);
+  *out++ = (char)(offset >> 8);
+  if ((match_code >= 15) &&
+      ((out = write_length(out, out_end, match_code - 15)) == NULL)) {
+    return NULL;
+  }
+  return out;
+}
+
+size_t lz_compress_bound(const size_t length) {
+  return length + length / 255 + 16;
+}
+
+size_t lz_compress(const char *src, const size_t src_length, char *dst,
+                   const size_t dst_capacity) {
+  // Positions + 1 of the last sequence seen with each hash, 0 for none
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  const char *out_end = dst + dst_capacity;
+  char *out = dst;
+  size_t anchor = 0;
+  size_t position = 0;
+  // Skip ahead faster through data that doesn't compress
+  size_t misses = 0;
+
+  while ((out != NULL) && (position + LZ_MIN_MATCH <= src_length)) {
+    const uint32_t hash = hash_sequence(src + position);
+    const size_t candidate = table[hash];
+    table[hash] = position + 1;
+
+    if ((candidate == 0) || (position - (candidate - 1) > LZ_MAX_OFFSET) ||
+        memcmp(src + candidate - 1, src + position, LZ_MIN_MATCH)) {
+      position += 1 + (misses++ >> 5);
+      continue;
+    }
+    misses = 0;
+
+    const size_t match = candidate - 1;
+    size_t match_length = LZ_MIN_MATCH;
+    while ((position + match_length < src_length) &&
+           (src[match + match_length] == src[position + match_length])) {
+      match_length++;
+    }
+
+    out = write_sequence(out, out_end, src + anchor, position - anchor,
+                         position - match, match_length);
+    position += match_length;
+    anchor = position;
+  }
+
+  if (out != NULL) {
+    out = write_sequence(out, out_end, src + anchor, src_length - anchor, 0, 0);
+  }
+  return out == NULL ? 0 : (size_t)(out - dst);
+}
+
+ssize_t lz_decompress(const char *src, const size_t src_length, char *dst,
+                      const size_t dst_capacity) {
+  const char *in = src;
+  const char *in_end = src + src_length;
+  char *out = dst;
+  const char *out_end = dst + dst_capacity;
+
+  while (in < in_end) {
+    const uint8_t token = (uint8_t)*in++;
+
+    size_t literal_count = token >> 4;
+    if ((literal_count == 15) &&
+        ((in = read_length(in, in_end, &literal_count)) == NULL)) {
+      return -1;
+    }
+    if (((size_t)(in_end - in) < literal_count) ||
+        ((size_t)(out_end - out) < literal_count)) {
+      return -1;
+    }
+    memcpy(out, in, literal_count);
+    in += literal_count;
+    out += literal_count;
+
+    if (in == in_end) {
+      // The last sequence has no match
+      break;
+    }
+
+    if (in_end - in < 2) {
+      return -1;
+    }
+    const size_t offset = (uint8_t)in[0] | ((size_t)(uint8_t)in[1] << 8);
+    in += 2;
+    size_t match_length = token & 15;
+    if ((match_length == 15) &&
+        ((in = read_length(in, in_end, &match_length)) == NULL)) {
+      return -1;
+    }
+    match_length += LZ_MIN_MATCH;
+    if ((offset == 0) || (offset > (size_t)(out - dst)) ||
+        ((size_t)(out_end - out) < match_length)) {
+      return -1;
+    }
+
+    // The match may overlap the bytes it produces
+    const char *match = out - offset;
+    for (size_t index = 0; index < match_length; index++) {
+      out[index] = match[index];
+    }
+    out += match_length;
+  }
+
+  return out - dst;
+}
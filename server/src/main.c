@@ -1,17 +1,11 @@
 /**
- * TODO: (low-priority) socket_client_receive_and_write_data could use a timeout
+ * TODO: (low-priority) socket_client_receive_packet could use a timeout
  * incase the client opens the connection but never sends any data
- * TODO: (high-priority) socket_client_receive_and_write_data should read data
- * into the heap and use realloc if the buffer is too small. By doing this the
- * file would only need to be openned for long enough to write that heap buffer
- * instead of being openned repeatedly with the stack buffer. This would also
- * result in the mutex being locked for a shorter duration. Right now if a
- * client opens a connection and doesn't send data, the mutex lock will block
- * all other threads indefinitley.
  */
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -28,9 +22,14 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "packet.h"
+#include "protocol.h"
 #include "queue.h"
+#include "search.h"
 #include "socket_client.h"
 #include "socket_server.h"
+#include "storage.h"
+#include "subscribers.h"
 #include "utilities.h"
 
 typedef struct {
@@ -39,6 +38,21 @@ typedef struct {
   pthread_t timestamp_logger_thread;
 } SetupData;
 
+/**
+ * State of a search between runs of packets
+ */
+typedef struct {
+  const ClientConnection *client;
+  const Command *command;
+  uint64_t matches;
+  /**
+   * Matches found in the current run of packets, sent at the end of the run
+   */
+  char *response;
+  size_t response_length;
+  size_t response_capacity;
+} SearchState;
+
 /**
  * @brief Runs the socket application. This application sets up a server that
  * waits for client connections, writes data from the client to file, then sends
@@ -72,18 +86,127 @@ static int setup_signal_handlers(timer_t *sugusr1_timer);
 
 /**
  * @brief Intended to be run in a thread. Completes the data transfer from the
- * client passed in `arg`. Data from the client is recieved and written to file,
- * then the entire contents of the file are sent back to the client.
+ * client passed in `arg`. A packet is received from the client. Unless it is a
+ * command, it is written to file, then the entire contents of the file are
+ * sent back to the client.
  * @param arg client file descriptor as an int*
  */
 static void *data_transfer_worker(void *arg);
 
+/**
+ * @brief Handles `COMMAND_COMPRESS`. Compresses the responses sent to `client`
+ * and leaves the request that follows the command in `data`, receiving it if
+ * it wasn't sent with the command.
+ * @param client client connection
+ * @param data data received with the command, replaced by the request
+ * @param length size of `data`
+ * @param command_length size of the command line at the start of `data`
+ * @return 0 if successful
+ * @return 1 if the client closed the connection without sending a request
+ * @return -1 otherwise
+ */
+static int enable_compression(ClientConnection *client, char **data,
+                              size_t *length, const size_t command_length);
+
+/**
+ * @brief Appends `packet` to `RESULT_FILE`, publishes it to the subscribers,
+ * then sends the entire contents of the file back to the client
+ * @param client client connection
+ * @param packet packet received from the client, released by this function
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int store_and_echo_packet(const ClientConnection *client,
+                                 struct packet *packet);
+
+/**
+ * @brief Handles `COMMAND_SUBSCRIBE`. Sends the entire contents of
+ * `RESULT_FILE` to the client, then every packet appended after it, until the
+ * client disconnects.
+ * @param client client connection
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int subscribe(const ClientConnection *client);
+
+/**
+ * @brief Handles `COMMAND_TAIL` and `COMMAND_SINCE`. Sends the
+ * `PROTOCOL_PACKETS` header then the requested packets that are still stored.
+ * @param client client connection
+ * @param command the command received
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int send_packets(const ClientConnection *client, const Command *command);
+
+/**
+ * @brief Handles `COMMAND_RANGE`. Sends the requested bytes of `RESULT_FILE`.
+ * @param client client connection
+ * @param command the command received
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int send_range(const ClientConnection *client, const Command *command);
+
+/**
+ * @brief Handles `COMMAND_SEARCH`. Scans the stored packets for the pattern
+ * and sends each match as it is found.
+ * @param client client connection
+ * @param command the command received
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int send_search_results(const ClientConnection *client,
+                               const Command *command);
+
+/**
+ * @brief Sends the packets in `packets` that contain the pattern of the search
+ * described by `context`. Used as a `StorageScanCallback`.
+ */
+static int search_packets(const char *packets, const size_t length,
+                          const uint64_t first_seq, void *context);
+
+/**
+ * @brief Handles `COMMAND_ACK_MODE`. Stores the packets received from the
+ * client until it disconnects, answering each one with `PROTOCOL_ACK` and its
+ * sequence number instead of the history.
+ * @param client client connection
+ * @param data data received with the command, released by this function
+ * @param length size of `data`
+ * @param command_length size of the command line at the start of `data`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int acknowledge_packets(const ClientConnection *client, char *data,
+                               const size_t length,
+                               const size_t command_length);
+
+/**
+ * @brief Sends a `PROTOCOL_ACK` line for each packet completed by `packet`
+ * @param client client connection
+ * @param packet packet that was just stored
+ * @param next_seq sequence number after the last packet completed by `packet`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int send_acks(const ClientConnection *client,
+                     const struct packet *packet,
+                     const uint64_t next_seq);
+
 /**
  * @brief Writes a timestamp in RFC 2822 complient format to `RESULT_FILE`
  * triggered by the `timestamp_sem`. This is inteneded to be run in a thread.
  */
 static void *log_timestamp_worker(void *arg);
 
+#if USE_AESD_CHAR_DEVICE != 1
+/**
+ * @brief Compresses the cold history as it grows, until the program is
+ * terminated. This is intended to be run in a thread.
+ */
+static void *cold_history_worker(void *arg);
+#endif
+
 /**
  * @brief SIGINT signal handler used to gracefully shutdown the program
  * @param sig signal number
@@ -155,6 +278,35 @@ int main(int argc, char *argv[]) {
     closelog();
     return -1;
   }
+
+  if (storage_init()) {
+    syslog(LOG_ERR, "storage_init");
+    pthread_mutex_destroy(config_get_result_file_mutex());
+    timer_delete(log_timestamp_timer);
+    close(server_socket);
+    freeaddrinfo(server_addrinfo);
+    closelog();
+    return -1;
+  }
+
+#if USE_AESD_CHAR_DEVICE != 1
+  // Setup Cold History Compressor
+  pthread_t cold_history_thread_id;
+  const int cold_history_create_result = pthread_create(
+      &cold_history_thread_id, NULL, cold_history_worker, NULL);
+  if (cold_history_create_result) {
+    syslog(LOG_ERR, "pthread_create returned error: %d",
+           cold_history_create_result);
+    storage_free();
+    pthread_mutex_destroy(config_get_result_file_mutex());
+    timer_delete(log_timestamp_timer);
+    close(server_socket);
+    freeaddrinfo(server_addrinfo);
+    closelog();
+    return -1;
+  }
+#endif
+
   // Run the application
   const int result = application(server_socket);
 
@@ -162,13 +314,22 @@ int main(int argc, char *argv[]) {
   pthread_join(timestamp_thread_id, NULL);
 
 #if USE_AESD_CHAR_DEVICE != 1
-  // Delete the file that is open during the application
+  pthread_join(cold_history_thread_id, NULL);
+
+  // Delete the files that are open during the application
   if (remove(RESULT_FILE) && (errno != ENOENT)) {
     perror("remove");
   }
+  if (remove(COLD_HISTORY_FILE) && (errno != ENOENT)) {
+    perror("remove");
+  }
+  if (remove(PACKET_MAP_FILE) && (errno != ENOENT)) {
+    perror("remove");
+  }
 #endif
 
   // Clean up
+  storage_free();
   pthread_mutex_destroy(config_get_result_file_mutex());
   timer_delete(log_timestamp_timer);
   close(server_socket);
@@ -332,31 +493,361 @@ void *data_transfer_worker(void *arg) {
   syslog(LOG_DEBUG, "Thread %ld started for client %d.", pthread_self(),
          thread_data->client_fd);
 
-  pthread_mutex_lock(config_get_result_file_mutex());
-  if (socket_client_receive_and_write_data(RESULT_FILE,
-                                           thread_data->client_fd) == -1) {
-    pthread_mutex_unlock(config_get_result_file_mutex());
-    syslog(LOG_ERR, "receive_data");
-    close(thread_data->client_fd);
+  ClientConnection client = {.fd = thread_data->client_fd};
+
+  // Receive the whole packet before locking the file, so a slow client doesn't
+  // block the other threads
+  char *data = NULL;
+  size_t length = 0;
+  Command command;
+  int receive_result =
+      socket_client_receive_packet(thread_data->client_fd, &data, &length);
+  if (receive_result == 0) {
+    protocol_parse_command(data, length, &command);
+    if (command.type == COMMAND_COMPRESS) {
+      receive_result =
+          enable_compression(&client, &data, &length, command.line_length);
+      if (receive_result == 0) {
+        protocol_parse_command(data, length, &command);
+      }
+    }
+  }
+
+  if (receive_result == -1) {
+    syslog(LOG_ERR, "receive_packet");
+    socket_client_close_connection(&client);
     thread_data->thread_status = FAILED;
     pthread_exit(NULL);
+  } else if (receive_result == 1) {
+    socket_client_close_connection(&client);
+    thread_data->thread_status = SUCCEEDED;
+    pthread_exit(NULL);
+  }
+
+  int result = 0;
+  switch (command.type) {
+  case COMMAND_SUBSCRIBE:
+    free(data);
+    result = subscribe(&client);
+    break;
+  case COMMAND_TAIL:
+  case COMMAND_SINCE:
+    free(data);
+    result = send_packets(&client, &command);
+    break;
+  case COMMAND_RANGE:
+    free(data);
+    result = send_range(&client, &command);
+    break;
+  case COMMAND_SEARCH:
+    // The pattern points into the packet
+    result = send_search_results(&client, &command);
+    free(data);
+    break;
+  case COMMAND_COMPRESS:
+    // Already compressing, nothing else was asked for
+    free(data);
+    break;
+  case COMMAND_ACK_MODE:
+    result = acknowledge_packets(&client, data, length,
+                                 command.line_length);
+    break;
+  case COMMAND_NONE: {
+    struct packet *packet = packet_create(data, length);
+    result = (packet == NULL)
+                 ? -1
+                 : store_and_echo_packet(&client, packet);
+    break;
+  }
+  }
+
+  socket_client_close_connection(&client);
+  thread_data->thread_status = result ? FAILED : SUCCEEDED;
+  pthread_exit(NULL);
+}
+
+int enable_compression(ClientConnection *client, char **data, size_t *length,
+                       const size_t command_length) {
+  if (socket_client_enable_compression(client)) {
+    free(*data);
+    *data = NULL;
+    return -1;
+  }
+
+  if (*length > command_length) {
+    memmove(*data, *data + command_length, *length - command_length);
+    *length -= command_length;
+    return 0;
+  }
+
+  free(*data);
+  *data = NULL;
+  return socket_client_receive_packet(client->fd, data, length);
+}
+
+int store_and_echo_packet(const ClientConnection *client,
+                          struct packet *packet) {
+  pthread_mutex_lock(config_get_result_file_mutex());
+  if (storage_append(packet->data, packet->length, NULL) == -1) {
+    pthread_mutex_unlock(config_get_result_file_mutex());
+    syslog(LOG_ERR, "storage_append");
+    packet_put(packet);
+    return -1;
   }
+  // Published under the lock so subscribers receive packets in file order
+  subscribers_publish(packet);
   pthread_mutex_unlock(config_get_result_file_mutex());
+  packet_put(packet);
 
   // Send the contents of the file back to the client
   pthread_mutex_lock(config_get_result_file_mutex());
-  if (socket_client_send_file(RESULT_FILE, thread_data->client_fd) == -1) {
+  if (storage_send_history(client) == -1) {
     pthread_mutex_unlock(config_get_result_file_mutex());
-    syslog(LOG_ERR, "send_file");
-    close(thread_data->client_fd);
-    thread_data->thread_status = FAILED;
-    pthread_exit(NULL);
+    syslog(LOG_ERR, "storage_send_history");
+    return -1;
   }
   pthread_mutex_unlock(config_get_result_file_mutex());
 
-  close(thread_data->client_fd);
-  thread_data->thread_status = SUCCEEDED;
-  pthread_exit(NULL);
+  return 0;
+}
+
+int subscribe(const ClientConnection *client) {
+  struct subscriber subscriber;
+  if (subscriber_init(&subscriber, client->fd)) {
+    syslog(LOG_ERR, "subscriber_init");
+    return -1;
+  }
+
+  // Subscribe while appends are locked out, so every packet is either in the
+  // history sent now or published afterwards
+  pthread_mutex_lock(config_get_result_file_mutex());
+  subscribers_add(&subscriber);
+  int result = storage_send_history(client);
+  pthread_mutex_unlock(config_get_result_file_mutex());
+
+  if (result == -1) {
+    syslog(LOG_ERR, "storage_send_history");
+  } else {
+    result = socket_client_stream_packets(client, &subscriber);
+  }
+
+  subscribers_remove(&subscriber);
+  subscriber_destroy(&subscriber);
+  return result;
+}
+
+int send_packets(const ClientConnection *client, const Command *command) {
+  pthread_mutex_lock(config_get_result_file_mutex());
+  uint64_t first_seq = 0;
+  uint64_t next_seq = 0;
+  if (storage_get_bounds(&first_seq, &next_seq) == -1) {
+    pthread_mutex_unlock(config_get_result_file_mutex());
+    syslog(LOG_ERR, "storage_get_bounds");
+    return -1;
+  }
+
+  // Clip the request to the stored packets
+  uint64_t seq = first_seq;
+  if (command->type == COMMAND_TAIL) {
+    if (command->count < next_seq - first_seq) {
+      seq = next_seq - command->count;
+    }
+  } else if (command->seq > first_seq) {
+    seq = (command->seq < next_seq) ? command->seq : next_seq;
+  }
+  const uint64_t count = next_seq - seq;
+
+  char header[64];
+  const int header_length =
+      snprintf(header, sizeof(header),
+               PROTOCOL_PACKETS "%" PRIu64 ",%" PRIu64 "\n", seq, count);
+  int result = socket_client_send_line(client, header, header_length);
+  if (result == 0) {
+    result = storage_send_packets(client, seq, count);
+  }
+  pthread_mutex_unlock(config_get_result_file_mutex());
+
+  if (result == -1) {
+    syslog(LOG_ERR, "send_packets");
+  }
+  return result;
+}
+
+int send_range(const ClientConnection *client, const Command *command) {
+  pthread_mutex_lock(config_get_result_file_mutex());
+  const int result =
+      storage_send_range(client, command->offset, command->length);
+  pthread_mutex_unlock(config_get_result_file_mutex());
+
+  if (result == -1) {
+    syslog(LOG_ERR, "storage_send_range");
+  }
+  return result;
+}
+
+int send_search_results(const ClientConnection *client,
+                        const Command *command) {
+  pthread_mutex_lock(config_get_result_file_mutex());
+  uint64_t first_seq = 0;
+  uint64_t next_seq = 0;
+  const int bounds_result = storage_get_bounds(&first_seq, &next_seq);
+  pthread_mutex_unlock(config_get_result_file_mutex());
+  if (bounds_result == -1) {
+    syslog(LOG_ERR, "storage_get_bounds");
+    return -1;
+  }
+
+  // Packets stored from now on are not searched
+  SearchState search = {.client = client, .command = command};
+  int result =
+      storage_scan(first_seq, next_seq, search_packets, (void *)&search);
+  free(search.response);
+  if (result == -1) {
+    syslog(LOG_ERR, "storage_scan");
+    return -1;
+  }
+
+  char footer[64];
+  const int footer_length = snprintf(
+      footer, sizeof(footer), PROTOCOL_MATCHES "%" PRIu64 "\n", search.matches);
+  return socket_client_send_line(client, footer, footer_length);
+}
+
+int search_packets(const char *packets, const size_t length,
+                   const uint64_t first_seq, void *context) {
+  SearchState *search = (SearchState *)context;
+  const char *end = packets + length;
+  const char *position = packets;
+  // The packet starting at `counted` is packet `seq`
+  const char *counted = packets;
+  uint64_t seq = first_seq;
+
+  search->response_length = 0;
+  const char *match = NULL;
+  while ((match = search_find(position, end - position,
+                              search->command->pattern,
+                              search->command->pattern_length)) != NULL) {
+    // Patterns hold no newline, so the match is within a single packet
+    const char *packet = match;
+    while ((packet > position) && (packet[-1] != '\n')) {
+      packet--;
+    }
+    const char *packet_end = (const char *)memchr(match, '\n', end - match) + 1;
+    seq += count_newlines(counted, packet - counted);
+    counted = packet;
+
+    // Make room for the prefix and the packet
+    const size_t needed = search->response_length + sizeof(PROTOCOL_MATCH) +
+                          21 + (packet_end - packet);
+    if (needed > search->response_capacity) {
+      const size_t capacity = needed > 2 * search->response_capacity
+                                  ? needed
+                                  : 2 * search->response_capacity;
+      char *response = realloc(search->response, capacity);
+      if (response == NULL) {
+        syslog(LOG_ERR, "realloc search response");
+        return -1;
+      }
+      search->response = response;
+      search->response_capacity = capacity;
+    }
+
+    search->response_length +=
+        sprintf(search->response + search->response_length,
+                PROTOCOL_MATCH "%" PRIu64 ":", seq);
+    memcpy(search->response + search->response_length, packet,
+           packet_end - packet);
+    search->response_length += packet_end - packet;
+    search->matches++;
+
+    position = packet_end;
+  }
+
+  // Stream the matches of each run as soon as it is scanned
+  if (search->response_length == 0) {
+    return 0;
+  }
+  return socket_client_send_line(search->client, search->response,
+                                 search->response_length);
+}
+
+int acknowledge_packets(const ClientConnection *client, char *data,
+                        const size_t length,
+                        const size_t command_length) {
+  // Packets sent along with the command are handled first
+  memmove(data, data + command_length, length - command_length);
+  ReceiveBuffer buffer = {
+      .data = data, .length = length - command_length, .capacity = length};
+
+  int result = 0;
+  int receive_result = 0;
+  while ((result == 0) && (receive_result == 0)) {
+    char *lines = NULL;
+    size_t lines_length = 0;
+    receive_result =
+        socket_client_receive_lines(client->fd, &buffer, &lines,
+                                    &lines_length);
+    if (receive_result == -1) {
+      syslog(LOG_ERR, "receive_lines");
+      result = -1;
+      break;
+    }
+    if (lines_length == 0) {
+      free(lines);
+      break;
+    }
+
+    struct packet *packet = packet_create(lines, lines_length);
+    if (packet == NULL) {
+      result = -1;
+      break;
+    }
+
+    // Every line received so far is stored with a single append
+    uint64_t next_seq = 0;
+    pthread_mutex_lock(config_get_result_file_mutex());
+    result = storage_append(packet->data, packet->length, &next_seq);
+    if (result == 0) {
+      subscribers_publish(packet);
+    }
+    pthread_mutex_unlock(config_get_result_file_mutex());
+
+    if (result == -1) {
+      syslog(LOG_ERR, "storage_append");
+    } else {
+      result = send_acks(client, packet, next_seq);
+    }
+    packet_put(packet);
+  }
+
+  free(buffer.data);
+  return result;
+}
+
+int send_acks(const ClientConnection *client, const struct packet *packet,
+              const uint64_t next_seq) {
+  const uint64_t count = count_newlines(packet->data, packet->length);
+  if (count == 0) {
+    return 0;
+  }
+
+  // Acknowledge the whole batch with one send
+  const size_t ack_size = sizeof(PROTOCOL_ACK) + 21;
+  char *acks = malloc(count * ack_size);
+  if (acks == NULL) {
+    syslog(LOG_ERR, "malloc acks");
+    return -1;
+  }
+
+  size_t acks_length = 0;
+  for (uint64_t seq = next_seq - count; seq < next_seq; seq++) {
+    acks_length += snprintf(acks + acks_length, ack_size,
+                            PROTOCOL_ACK "%" PRIu64 "\n", seq);
+  }
+
+  const int result = socket_client_send_line(client, acks, acks_length);
+  free(acks);
+  return result;
 }
 
 void *log_timestamp_worker(void *arg) {
@@ -382,11 +873,20 @@ void *log_timestamp_worker(void *arg) {
     strcat(time_string, "\n");
 
 #if USE_AESD_CHAR_DEVICE != 1
-    pthread_mutex_lock(config_get_result_file_mutex());
-    if (append_to_file(RESULT_FILE, time_string, strlen(time_string))) {
-      syslog(LOG_ERR, "append_to_file");
+    struct packet *packet =
+        packet_create(strdup(time_string), strlen(time_string));
+    if (packet == NULL) {
+      syslog(LOG_ERR, "packet_create");
+    } else {
+      pthread_mutex_lock(config_get_result_file_mutex());
+      if (storage_append(packet->data, packet->length, NULL)) {
+        syslog(LOG_ERR, "storage_append");
+      } else {
+        subscribers_publish(packet);
+      }
+      pthread_mutex_unlock(config_get_result_file_mutex());
+      packet_put(packet);
     }
-    pthread_mutex_unlock(config_get_result_file_mutex());
 #endif
 
     // Subsequent wait. This allows is_terminated to be set then the semaphore
@@ -397,6 +897,23 @@ void *log_timestamp_worker(void *arg) {
   pthread_exit(NULL);
 }
 
+#if USE_AESD_CHAR_DEVICE != 1
+void *cold_history_worker(void *arg) {
+  while (!config_is_terminated()) {
+    // Catch up on everything due, then check again later
+    int result = 0;
+    while ((result = storage_compress_cold_history()) == 0) {
+    }
+    if (result == -1) {
+      syslog(LOG_ERR, "storage_compress_cold_history");
+    }
+    sleep(1);
+  }
+
+  pthread_exit(NULL);
+}
+#endif
+
 void sigint_handler(int sig) {
   syslog(LOG_DEBUG, "termination signal received");
   config_set_is_terminated();
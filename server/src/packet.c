@@ -0,0 +1,39 @@
+#include "packet.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+struct packet *packet_create(char *data, const size_t length) {
+  if (data == NULL) {
+    return NULL;
+  }
+
+  struct packet *packet = malloc(sizeof(struct packet));
+  if (packet == NULL) {
+    syslog(LOG_ERR, "malloc packet");
+    free(data);
+    return NULL;
+  }
+
+  atomic_init(&packet->refcount, 1);
+  packet->length = length;
+  packet->data = data;
+  return packet;
+}
+
+struct packet *packet_get(struct packet *packet) {
+  atomic_fetch_add_explicit(&packet->refcount, 1, memory_order_relaxed);
+  return packet;
+}
+
+void packet_put(struct packet *packet) {
+  // The last holder must see every access made through the other references
+  if (atomic_fetch_sub_explicit(&packet->refcount, 1, memory_order_acq_rel) !=
+      1) {
+    return;
+  }
+
+  free(packet->data);
+  free(packet);
+}
@@ -0,0 +1,106 @@
+#include "protocol.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief returns true if the line `line` of `length` bytes is `keyword`
+ */
+static bool line_equals(const char *line, const size_t length,
+                        const char *keyword) {
+  return (length == strlen(keyword)) && (memcmp(line, keyword, length) == 0);
+}
+
+/**
+ * @brief returns true if the line `line` of `length` bytes starts with
+ * `prefix`, and moves `line` and `length` past it
+ */
+static bool consume_prefix(const char **line, size_t *length,
+                           const char *prefix) {
+  const size_t prefix_length = strlen(prefix);
+  if ((*length < prefix_length) || (memcmp(*line, prefix, prefix_length))) {
+    return false;
+  }
+
+  *line += prefix_length;
+  *length -= prefix_length;
+  return true;
+}
+
+/**
+ * @brief Parses the decimal number at the start of `line` and moves `line` and
+ * `length` past it
+ * @return true if at least one digit was parsed without overflowing
+ */
+static bool consume_number(const char **line, size_t *length,
+                           uint64_t *value) {
+  size_t digits = 0;
+  *value = 0;
+  while ((digits < *length) && ((*line)[digits] >= '0') &&
+         ((*line)[digits] <= '9')) {
+    const uint64_t digit = (*line)[digits] - '0';
+    if (*value > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    *value = *value * 10 + digit;
+    digits++;
+  }
+
+  *line += digits;
+  *length -= digits;
+  return digits > 0;
+}
+
+void protocol_parse_command(const char *packet, const size_t length,
+                            Command *command) {
+  memset(command, 0, sizeof(Command));
+  command->type = COMMAND_NONE;
+
+  // A command is a single line, "\n" or "\r\n" terminated
+  const char *newline = memchr(packet, '\n', length);
+  if (newline == NULL) {
+    return;
+  }
+  command->line_length = newline + 1 - packet;
+  const char *line = packet;
+  size_t line_length = newline - packet;
+  if ((line_length > 0) && (packet[line_length - 1] == '\r')) {
+    line_length--;
+  }
+
+  if (line_equals(line, line_length, PROTOCOL_ACK_MODE)) {
+    command->type = COMMAND_ACK_MODE;
+  } else if (line_equals(line, line_length, PROTOCOL_COMPRESS)) {
+    command->type = COMMAND_COMPRESS;
+  } else if (command->line_length != length) {
+    // Not a command, or data follows one that doesn't take any
+    return;
+  } else if (line_equals(line, line_length, PROTOCOL_SUBSCRIBE)) {
+    command->type = COMMAND_SUBSCRIBE;
+  } else if (consume_prefix(&line, &line_length, PROTOCOL_TAIL)) {
+    if (consume_number(&line, &line_length, &command->count) &&
+        (line_length == 0)) {
+      command->type = COMMAND_TAIL;
+    }
+  } else if (consume_prefix(&line, &line_length, PROTOCOL_SINCE)) {
+    if (consume_number(&line, &line_length, &command->seq) &&
+        (line_length == 0)) {
+      command->type = COMMAND_SINCE;
+    }
+  } else if (consume_prefix(&line, &line_length, PROTOCOL_RANGE)) {
+    if (consume_number(&line, &line_length, &command->offset) &&
+        consume_prefix(&line, &line_length, ",") &&
+        consume_number(&line, &line_length, &command->length) &&
+        (line_length == 0)) {
+      command->type = COMMAND_RANGE;
+    }
+  } else if (consume_prefix(&line, &line_length, PROTOCOL_SEARCH)) {
+    if (line_length > 0) {
+      command->type = COMMAND_SEARCH;
+      command->pattern = line;
+      command->pattern_length = line_length;
+    }
+  }
+}
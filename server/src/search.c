@@ -0,0 +1,133 @@
+#include "search.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_HAVE_X86 (1)
+#endif
+
+/**
+ * Each SIMD variant compares a block of the haystack against the first byte of
+ * the needle and the block `needle_length - 1` bytes further against its last
+ * byte. Only the positions where both match are compared in full, which skips
+ * most of the haystack a whole block at a time.
+ */
+
+/**
+ * @brief Scalar search, also used for the tail the SIMD loops leave
+ */
+static const char *find_scalar(const char *haystack, const size_t length,
+                               const char *needle, const size_t needle_length) {
+  if (needle_length > length) {
+    return NULL;
+  }
+
+  const char *last_start = haystack + length - needle_length;
+  const char *candidate = haystack;
+  while ((candidate = memchr(candidate, needle[0],
+                             last_start - candidate + 1)) != NULL) {
+    if (memcmp(candidate + 1, needle + 1, needle_length - 1) == 0) {
+      return candidate;
+    }
+    candidate++;
+  }
+
+  return NULL;
+}
+
+#ifdef SEARCH_HAVE_X86
+
+/**
+ * @brief returns the match at one of the positions set in `mask`, relative to
+ * `block`, or NULL
+ */
+static inline const char *check_candidates(const char *block, uint32_t mask,
+                                           const char *needle,
+                                           const size_t needle_length) {
+  while (mask != 0) {
+    const int bit = __builtin_ctz(mask);
+    // The first and last bytes are already known to match
+    if ((needle_length <= 2) ||
+        (memcmp(block + bit + 1, needle + 1, needle_length - 2) == 0)) {
+      return block + bit;
+    }
+    mask &= mask - 1;
+  }
+
+  return NULL;
+}
+
+__attribute__((target("sse2"))) static const char *
+find_sse2(const char *haystack, const size_t length, const char *needle,
+          const size_t needle_length) {
+  if (needle_length > length) {
+    return NULL;
+  }
+
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+  size_t offset = 0;
+  for (; offset + needle_length - 1 + 16 <= length; offset += 16) {
+    const __m128i block_first =
+        _mm_loadu_si128((const __m128i *)(haystack + offset));
+    const __m128i block_last = _mm_loadu_si128(
+        (const __m128i *)(haystack + offset + needle_length - 1));
+    const uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+    const char *match =
+        check_candidates(haystack + offset, mask, needle, needle_length);
+    if (match != NULL) {
+      return match;
+    }
+  }
+
+  return find_scalar(haystack + offset, length - offset, needle,
+                     needle_length);
+}
+
+__attribute__((target("avx2"))) static const char *
+find_avx2(const char *haystack, const size_t length, const char *needle,
+          const size_t needle_length) {
+  if (needle_length > length) {
+    return NULL;
+  }
+
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+  size_t offset = 0;
+  for (; offset + needle_length - 1 + 32 <= length; offset += 32) {
+    const __m256i block_first =
+        _mm256_loadu_si256((const __m256i *)(haystack + offset));
+    const __m256i block_last = _mm256_loadu_si256(
+        (const __m256i *)(haystack + offset + needle_length - 1));
+    const uint32_t mask = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                         _mm256_cmpeq_epi8(last, block_last)));
+    const char *match =
+        check_candidates(haystack + offset, mask, needle, needle_length);
+    if (match != NULL) {
+      return match;
+    }
+  }
+
+  // Finish 16 bytes at a time before falling back to the scalar search
+  return find_sse2(haystack + offset, length - offset, needle, needle_length);
+}
+
+#endif
+
+const char *search_find(const char *haystack, const size_t haystack_length,
+                        const char *needle, const size_t needle_length) {
+#ifdef SEARCH_HAVE_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return find_avx2(haystack, haystack_length, needle, needle_length);
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return find_sse2(haystack, haystack_length, needle, needle_length);
+  }
+#endif
+  return find_scalar(haystack, haystack_length, needle, needle_length);
+}
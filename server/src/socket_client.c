@@ -3,6 +3,8 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,8 +13,26 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "lz.h"
+#include "packet.h"
+#include "protocol.h"
+#include "subscribers.h"
 #include "utilities.h"
 
+/**
+ * @brief returns true if the client `client_fd` has closed its end of the
+ * connection
+ */
+static bool is_client_closed(const int client_fd) {
+  char byte;
+  const ssize_t result = recv(client_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (result == -1) {
+    return (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR);
+  }
+
+  return result == 0;
+}
+
 int socket_client_create_connection(const int server_fd, int *client_fd_ptr,
                                     const struct timespec *timeout_ptr) {
   struct sockaddr_in client_addr;
@@ -59,40 +79,206 @@ int socket_client_create_connection(const int server_fd, int *client_fd_ptr,
   return 0;
 }
 
-int socket_client_receive_and_write_data(char *file, const int client_fd) {
-  char recv_buffer[BUFFER_SIZE];
-  size_t bytes_received = 0;
+int socket_client_enable_compression(ClientConnection *client) {
+  if (client->frame_buffer == NULL) {
+    client->frame_buffer = malloc(COMPRESSED_FRAME_SIZE);
+    if (client->frame_buffer == NULL) {
+      syslog(LOG_ERR, "malloc frame buffer");
+      return -1;
+    }
+  }
+
+  client->is_compressed = true;
+  return 0;
+}
+
+void socket_client_close_connection(ClientConnection *client) {
+  free(client->frame_buffer);
+  client->frame_buffer = NULL;
+  close(client->fd);
+}
+
+int socket_client_receive_packet(const int client_fd, char **packet_ptr,
+                                 size_t *length_ptr) {
+  size_t capacity = BUFFER_SIZE;
+  size_t length = 0;
+  char *packet = malloc(capacity);
+  if (packet == NULL) {
+    syslog(LOG_ERR, "malloc packet");
+    return -1;
+  }
+
+  while (true) {
+    if (length == capacity) {
+      // Grow geometrically so long packets are only copied a few times
+      char *grown_packet = realloc(packet, 2 * capacity);
+      if (grown_packet == NULL) {
+        syslog(LOG_ERR, "realloc packet");
+        free(packet);
+        return -1;
+      }
+      packet = grown_packet;
+      capacity *= 2;
+    }
 
-  do {
-    bytes_received = recv(client_fd, recv_buffer, sizeof(recv_buffer), 0);
+    const ssize_t bytes_received =
+        recv(client_fd, packet + length, capacity - length, 0);
     if (bytes_received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
       perror("recv");
+      free(packet);
       return -1;
     }
 
-    // Add data to end of the file
-    if (append_to_file(file, recv_buffer, bytes_received) == -1) {
-      syslog(LOG_ERR, "append_to_file");
-      return -1;
+    if (bytes_received == 0) {
+      // The client has finished sending
+      break;
     }
-  } while (bytes_received == BUFFER_SIZE);
 
+    const bool is_complete =
+        memchr(packet + length, '\n', bytes_received) != NULL;
+    length += bytes_received;
+    if (is_complete) {
+      break;
+    }
+  }
+
+  if (length == 0) {
+    free(packet);
+    return 1;
+  }
+
+  *packet_ptr = packet;
+  *length_ptr = length;
   return 0;
 }
 
-int socket_client_send_file(char *file, const int client_fd) {
+/**
+ * @brief returns the size of the complete lines at the start of `data`, up to
+ * and including its last newline
+ */
+static size_t complete_lines_length(const char *data, const size_t length) {
+  size_t lines_length = length;
+  while ((lines_length > 0) && (data[lines_length - 1] != '\n')) {
+    lines_length--;
+  }
+  return lines_length;
+}
+
+/**
+ * @brief Moves the first `lines_length` bytes of `buffer` to a heap buffer of
+ * their own, without copying them, and keeps the rest in `buffer`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int take_lines(ReceiveBuffer *buffer, const size_t lines_length,
+                      char **lines) {
+  const size_t remaining = buffer->length - lines_length;
+  const size_t capacity = remaining > BUFFER_SIZE ? remaining : BUFFER_SIZE;
+  char *data = malloc(capacity);
+  if (data == NULL) {
+    syslog(LOG_ERR, "malloc receive buffer");
+    return -1;
+  }
+  memcpy(data, buffer->data + lines_length, remaining);
+
+  *lines = buffer->data;
+  buffer->data = data;
+  buffer->length = remaining;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+int socket_client_receive_lines(const int client_fd, ReceiveBuffer *buffer,
+                                char **lines, size_t *lines_length) {
+  // Lines may already have been received along with earlier ones
+  *lines_length = complete_lines_length(buffer->data, buffer->length);
+  while (*lines_length == 0) {
+    if (buffer->length == buffer->capacity) {
+      // Grow geometrically so long lines are only copied a few times
+      const size_t capacity =
+          buffer->capacity ? 2 * buffer->capacity : BUFFER_SIZE;
+      char *data = realloc(buffer->data, capacity);
+      if (data == NULL) {
+        syslog(LOG_ERR, "realloc receive buffer");
+        return -1;
+      }
+      buffer->data = data;
+      buffer->capacity = capacity;
+    }
+
+    // Wait in short steps so termination is noticed
+    struct pollfd client_pollfd = {.fd = client_fd, .events = POLLIN};
+    const int poll_result = poll(&client_pollfd, 1, 1000);
+    if (poll_result == -1 && errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+    if (config_is_terminated()) {
+      break;
+    }
+    if (poll_result <= 0) {
+      continue;
+    }
+
+    const ssize_t bytes_received =
+        recv(client_fd, buffer->data + buffer->length,
+             buffer->capacity - buffer->length, 0);
+    if (bytes_received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("recv");
+      return -1;
+    }
+    if (bytes_received == 0) {
+      break;
+    }
+
+    // Only the new data can hold a newline
+    const size_t new_lines_length = complete_lines_length(
+        buffer->data + buffer->length, bytes_received);
+    if (new_lines_length != 0) {
+      *lines_length = buffer->length + new_lines_length;
+    }
+    buffer->length += bytes_received;
+  }
+
+  if (*lines_length == 0) {
+    // Closed, hand over any incomplete line
+    *lines_length = buffer->length;
+    return take_lines(buffer, buffer->length, lines) ? -1 : 1;
+  }
+
+  return take_lines(buffer, *lines_length, lines);
+}
+
+int socket_client_send_file(char *file, const ClientConnection *client) {
   const int fd = open(file, O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      // Nothing has been written yet
+      return 0;
+    }
+    perror("open");
+    return -1;
+  }
 
   // TODO: This should be allocated to a size dynamically instead of just
   // setting the size needed to pass the test. This section needed to be
   // reworked since the driver didn't work with getline().
-  size_t line_len = 32768;
+  // Compressed connections read a whole frame at a time
+  size_t line_len = client->is_compressed ? COMPRESSED_FRAME_SIZE : 32768;
   char *line = malloc(line_len);
   ssize_t bytes_read = read(fd, line, line_len);
   while (bytes_read != 0) {
     syslog(LOG_INFO, "Read bytes: %ld", bytes_read);
-    if (socket_client_send_line(client_fd, line, bytes_read)) {
+    if (socket_client_send_line(client, line, bytes_read)) {
       syslog(LOG_ERR, "socket_client_send_line send");
+      free(line);
+      close(fd);
       return -1;
     }
     bytes_read = read(fd, line, line_len);
@@ -103,9 +289,16 @@ int socket_client_send_file(char *file, const int client_fd) {
   return 0;
 }
 
-int socket_client_send_line(const int client_fd, char *line, const size_t length) {
-  syslog(LOG_INFO, "Sending size (%lu):  %s", length, line);
-  size_t bytes_sent = send(client_fd, line, length, 0);
+/**
+ * @brief Sends `length` bytes of `data` to `client_fd`
+ * @param flags flags for `send`, besides MSG_NOSIGNAL
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int send_bytes(const int client_fd, const void *data,
+                      const size_t length, const int flags) {
+  // A client that has gone away must not raise SIGPIPE and end the server
+  size_t bytes_sent = send(client_fd, data, length, MSG_NOSIGNAL | flags);
   if (bytes_sent == -1) {
     perror("send");
     return -1;
@@ -118,3 +311,81 @@ int socket_client_send_line(const int client_fd, char *line, const size_t length
 
   return 0;
 }
+
+int socket_client_send_line(const ClientConnection *client, char *line,
+                            const size_t length) {
+  syslog(LOG_INFO, "Sending size (%lu):  %.*s", length, (int)length, line);
+  if (!client->is_compressed) {
+    return send_bytes(client->fd, line, length, 0);
+  }
+
+  char *frame = client->frame_buffer;
+  int result = 0;
+  for (size_t sent = 0; (result == 0) && (sent < length);) {
+    const size_t raw_length = length - sent < COMPRESSED_FRAME_SIZE
+                                  ? length - sent
+                                  : COMPRESSED_FRAME_SIZE;
+    // Data that doesn't shrink is sent as is
+    const size_t frame_length =
+        lz_compress(line + sent, raw_length, frame, raw_length - 1);
+    if (frame_length == 0) {
+      result = socket_client_send_frame(client, line + sent, raw_length,
+                                        raw_length);
+    } else {
+      result = socket_client_send_frame(client, frame, frame_length,
+                                        raw_length);
+    }
+    sent += raw_length;
+  }
+
+  return result;
+}
+
+int socket_client_send_frame(const ClientConnection *client, const char *data,
+                             const size_t length, const size_t raw_length) {
+  if ((raw_length > PROTOCOL_MAX_FRAME_SIZE) || (length > raw_length)) {
+    syslog(LOG_ERR, "frame of %zu bytes is too large", raw_length);
+    return -1;
+  }
+
+  syslog(LOG_INFO, "Sending frame (%zu of %zu bytes)", length, raw_length);
+  const uint32_t header[PROTOCOL_FRAME_HEADER_SIZE / sizeof(uint32_t)] = {
+      htonl(raw_length), htonl(length)};
+  if (send_bytes(client->fd, header, sizeof(header), MSG_MORE)) {
+    return -1;
+  }
+  return send_bytes(client->fd, data, length, 0);
+}
+
+int socket_client_stream_packets(const ClientConnection *client,
+                                 struct subscriber *subscriber) {
+  const int client_fd = client->fd;
+  const struct timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+  while (!config_is_terminated()) {
+    struct packet *packet = NULL;
+    switch (subscriber_wait(subscriber, &packet, &timeout)) {
+    case 0: { // packet published
+      const int send_result =
+          socket_client_send_line(client, packet->data, packet->length);
+      packet_put(packet);
+      if (send_result) {
+        syslog(LOG_INFO, "Subscriber %d closed the connection", client_fd);
+        return 0;
+      }
+      break;
+    }
+    case 1: // timeout, check the client is still there
+      if (is_client_closed(client_fd)) {
+        syslog(LOG_INFO, "Subscriber %d closed the connection", client_fd);
+        return 0;
+      }
+      break;
+    default: // fell behind
+      syslog(LOG_WARNING, "Subscriber %d fell behind, disconnecting",
+             client_fd);
+      return 0;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,1669 @@
+// fallocate
+#define _GNU_SOURCE
+
+#include "storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "lz.h"
+#include "protocol.h"
+#include "socket_client.h"
+#include "utilities.h"
+
+/**
+ * Bytes of history read at a time by `storage_scan`
+ */
+#define SCAN_CHUNK_SIZE (65536)
+/**
+ * Bytes of history sent at a time
+ */
+#define SEND_CHUNK_SIZE (32768)
+
+#if USE_AESD_CHAR_DEVICE == 1
+
+#include "../../aesd-char-driver/aesd_ioctl.h"
+
+/**
+ * @brief Gets the description of the entries retained by the device
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int get_device_info(struct aesd_info *info) {
+  const int fd = open(RESULT_FILE, O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  const int result = ioctl(fd, AESDCHAR_IOCGINFO, info);
+  if (result == -1) {
+    perror("ioctl AESDCHAR_IOCGINFO");
+  }
+
+  close(fd);
+  return result;
+}
+
+int storage_init(void) { return 0; }
+
+void storage_free(void) {}
+
+int storage_append(char *data, const size_t length, uint64_t *next_seq_rtn) {
+  if (append_to_file(RESULT_FILE, data, length) == -1) {
+    syslog(LOG_ERR, "append_to_file");
+    return -1;
+  }
+
+  if (next_seq_rtn == NULL) {
+    return 0;
+  }
+
+  struct aesd_info info;
+  if (get_device_info(&info) == -1) {
+    return -1;
+  }
+  *next_seq_rtn = info.next_seq;
+  return 0;
+}
+
+int storage_get_bounds(uint64_t *first_seq_rtn, uint64_t *next_seq_rtn) {
+  struct aesd_info info;
+  if (get_device_info(&info) == -1) {
+    return -1;
+  }
+
+  *first_seq_rtn = info.first_seq;
+  *next_seq_rtn = info.next_seq;
+  return 0;
+}
+
+/**
+ * @brief Copies the entries of the device from `seq` to before `end_seq` into
+ * a heap buffer, clipped to the entries it still retains
+ * @param fd open device
+ * @param buffer pointer to the location to store the buffer, which the caller
+ * must free
+ * @param length pointer to the location to store the size of `buffer`
+ * @param first_seq_rtn pointer to the location to store the sequence number
+ * of the first entry copied
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int fetch_entries(const int fd, uint64_t seq, uint64_t end_seq,
+                         char **buffer, size_t *length,
+                         uint64_t *first_seq_rtn) {
+  struct aesd_info info;
+  if (ioctl(fd, AESDCHAR_IOCGINFO, &info) == -1) {
+    perror("ioctl AESDCHAR_IOCGINFO");
+    return -1;
+  }
+
+  if (end_seq > info.next_seq) {
+    end_seq = info.next_seq;
+  }
+  if (seq < info.first_seq) {
+    seq = info.first_seq;
+  }
+  if (end_seq < seq) {
+    end_seq = seq;
+  }
+
+  // Size the buffer for exactly the requested entries
+  size_t buffer_size = 0;
+  for (uint64_t index = seq - info.first_seq;
+       index < end_seq - info.first_seq; index++) {
+    buffer_size += info.entry_size[index];
+  }
+
+  *buffer = malloc(buffer_size ? buffer_size : 1);
+  if (*buffer == NULL) {
+    syslog(LOG_ERR, "malloc fetch buffer");
+    return -1;
+  }
+
+  *length = 0;
+  *first_seq_rtn = seq;
+  if (buffer_size == 0) {
+    return 0;
+  }
+
+  struct aesd_fetch fetch = {
+      .seq = seq,
+      .buf = (uintptr_t)*buffer,
+      .buf_size = buffer_size,
+      .count = end_seq - seq,
+  };
+  if (ioctl(fd, AESDCHAR_IOCFETCH, &fetch) == -1) {
+    perror("ioctl AESDCHAR_IOCFETCH");
+    free(*buffer);
+    return -1;
+  }
+
+  *length = fetch.buf_size;
+  return 0;
+}
+
+int storage_send_packets(const ClientConnection *client, const uint64_t seq,
+                         const uint64_t count) {
+  if (count == 0) {
+    return 0;
+  }
+
+  const int fd = open(RESULT_FILE, O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  char *buffer = NULL;
+  size_t length = 0;
+  uint64_t first_seq = 0;
+  int result =
+      fetch_entries(fd, seq, seq + count, &buffer, &length, &first_seq);
+  close(fd);
+  if (result == -1) {
+    return -1;
+  }
+
+  result = socket_client_send_line(client, buffer, length);
+  free(buffer);
+  return result;
+}
+
+int storage_send_range(const ClientConnection *client, const uint64_t offset,
+                       uint64_t length) {
+  if (length == 0) {
+    return 0;
+  }
+  if (length > UINT64_MAX - offset) {
+    length = UINT64_MAX - offset;
+  }
+
+  // The device can't seek, the range is cut from the entries that hold it
+  const int fd = open(RESULT_FILE, O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  char *buffer = NULL;
+  size_t buffer_length = 0;
+  uint64_t skip = 0;
+  for (;;) {
+    struct aesd_info info;
+    if (ioctl(fd, AESDCHAR_IOCGINFO, &info) == -1) {
+      perror("ioctl AESDCHAR_IOCGINFO");
+      close(fd);
+      return -1;
+    }
+
+    // Find the entries holding the range, offsets start at the oldest one
+    uint64_t seq = info.first_seq;
+    uint64_t entry_offset = 0;
+    uint32_t index = 0;
+    for (; (index < info.entry_count) &&
+           (entry_offset + info.entry_size[index] <= offset);
+         index++) {
+      entry_offset += info.entry_size[index];
+    }
+    seq += index;
+    uint64_t end_seq = seq;
+    for (uint64_t end_offset = entry_offset;
+         (index < info.entry_count) && (end_offset < offset + length);
+         index++, end_seq++) {
+      end_offset += info.entry_size[index];
+    }
+    if (seq == end_seq) {
+      close(fd); // Nothing retained at `offset`
+      return 0;
+    }
+
+    uint64_t first_seq = 0;
+    if (fetch_entries(fd, seq, end_seq, &buffer, &buffer_length,
+                      &first_seq) == -1) {
+      close(fd);
+      return -1;
+    }
+    if (first_seq == seq) {
+      skip = offset - entry_offset;
+      break;
+    }
+
+    // The first entry was evicted meanwhile, every offset has moved
+    free(buffer);
+  }
+  close(fd);
+
+  if (length > buffer_length - skip) {
+    length = buffer_length - skip;
+  }
+  const int result = socket_client_send_line(client, buffer + skip, length);
+  free(buffer);
+  return result;
+}
+
+int storage_send_history(const ClientConnection *client) {
+  return socket_client_send_file(RESULT_FILE, client);
+}
+
+int storage_compress_cold_history(void) { return 1; }
+
+int storage_scan(uint64_t seq, uint64_t next_seq, StorageScanCallback callback,
+                 void *context) {
+  if (seq >= next_seq) {
+    return 0;
+  }
+
+  // The device retains few entries, they are scanned in one run
+  const int fd = open(RESULT_FILE, O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  char *buffer = NULL;
+  size_t length = 0;
+  uint64_t first_seq = 0;
+  int result = fetch_entries(fd, seq, next_seq, &buffer, &length, &first_seq);
+  close(fd);
+  if (result == -1) {
+    return -1;
+  }
+
+  if (length > 0) {
+    result = callback(buffer, length, first_seq, context);
+  }
+  free(buffer);
+  return result;
+}
+
+#else
+
+/**
+ * History before `cold_end` is moved out of RESULT_FILE in segments, each
+ * compressed on its own into COLD_HISTORY_FILE after a ColdSegmentHeader.
+ * The bytes a segment leaves in RESULT_FILE are punched out, so the file
+ * keeps its size and every offset stays valid. Reads go through a
+ * HistoryReader, which decompresses the segments they touch.
+ */
+typedef struct {
+  uint64_t offset;
+  uint64_t length;
+  /**
+   * Position of the compressed data in COLD_HISTORY_FILE
+   */
+  uint64_t data_offset;
+  /**
+   * Equal to `length` when the segment did not compress and is stored as is
+   */
+  uint64_t compressed_length;
+} ColdSegment;
+
+#define COLD_SEGMENT_MAGIC (0x5a534541) // "AESZ"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t compressed_length;
+} ColdSegmentHeader;
+
+static ColdSegment *cold_segments = NULL;
+static size_t cold_segment_count = 0;
+static size_t cold_segments_capacity = 0;
+static uint64_t cold_end = 0;
+/**
+ * Held shared while reading the history, and exclusively while a segment
+ * moves from RESULT_FILE to COLD_HISTORY_FILE
+ */
+static pthread_rwlock_t cold_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * A chunk of history, COMPRESSED_FRAME_SIZE bytes from an offset that is a
+ * multiple of it, compressed for compressed connections. The cache is direct
+ * mapped on the chunk offset and protected by the result file mutex, which
+ * every send holds.
+ */
+typedef struct {
+  bool is_valid;
+  uint64_t offset;
+  /**
+   * Size of `data`, COMPRESSED_FRAME_SIZE when the chunk is stored as is
+   */
+  size_t length;
+  char *data;
+} CompressedChunk;
+
+static CompressedChunk compressed_chunks[COMPRESSED_CHUNK_CACHE_SIZE];
+
+/**
+ * The file offset of packet `seq` is packet_offsets[seq]. Element
+ * `packet_count` is the offset just past the last complete packet.
+ */
+static uint64_t *packet_offsets = NULL;
+static size_t packet_offsets_capacity = 0;
+static uint64_t packet_count = 0;
+/**
+ * Size of the history, including a trailing incomplete packet
+ */
+static uint64_t file_size = 0;
+
+#if DEDUPLICATE_PACKETS == 1
+/**
+ * Each distinct packet is stored once in RESULT_FILE, as a line called a
+ * payload, and PACKET_MAP_FILE lists the payload of every packet as a 32 bit
+ * index. The history is rebuilt from both when it is read, so packet offsets
+ * are offsets in the history rather than in RESULT_FILE. A trailing incomplete
+ * packet is stored as is after the payloads until it is completed.
+ *
+ * Element `payload_count` of `payload_offsets` is the end of the last payload.
+ */
+static uint64_t *payload_offsets = NULL;
+static uint64_t *payload_hashes = NULL;
+static size_t payload_capacity = 0;
+static uint64_t payload_count = 0;
+/**
+ * Open addressing table of the newest payload with each hash, as its index
+ * + 1, 0 for an empty slot. The capacity is a power of two.
+ */
+static uint32_t *payload_table = NULL;
+static size_t payload_table_capacity = 0;
+/**
+ * Payload of packet `seq`, with the capacity of `packet_offsets`
+ */
+static uint32_t *packet_payloads = NULL;
+/**
+ * Size of RESULT_FILE
+ */
+static uint64_t stored_size = 0;
+/**
+ * Held shared while the history is mapped to the payloads, and exclusively
+ * while packets are added, since `storage_scan` reads without the result file
+ * mutex
+ */
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
+/**
+ * Reads the history whether it is in RESULT_FILE or in a cold segment
+ */
+typedef struct {
+  int fd;
+  int cold_fd;
+  /**
+   * Index of the cold segment in `segment_data`, SIZE_MAX for none
+   */
+  size_t segment;
+  char *segment_data;
+  size_t segment_capacity;
+  char *compressed_data;
+  size_t compressed_capacity;
+} HistoryReader;
+
+/**
+ * @brief Opens `reader` on the history
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int reader_open(HistoryReader *reader) {
+  memset(reader, 0, sizeof(HistoryReader));
+  reader->cold_fd = -1;
+  reader->segment = SIZE_MAX;
+  reader->fd = open(RESULT_FILE, O_RDONLY);
+  if (reader->fd == -1) {
+    perror("open");
+    return -1;
+  }
+  return 0;
+}
+
+static void reader_close(HistoryReader *reader) {
+  close(reader->fd);
+  if (reader->cold_fd != -1) {
+    close(reader->cold_fd);
+  }
+  free(reader->segment_data);
+  free(reader->compressed_data);
+}
+
+/**
+ * @brief Grows the buffer `data` of `capacity` bytes to hold `size` bytes
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int reserve(char **data, size_t *capacity, const size_t size) {
+  if (size <= *capacity) {
+    return 0;
+  }
+
+  char *grown_data = realloc(*data, size);
+  if (grown_data == NULL) {
+    syslog(LOG_ERR, "realloc reader buffer");
+    return -1;
+  }
+  *data = grown_data;
+  *capacity = size;
+  return 0;
+}
+
+/**
+ * @brief Reads exactly `length` bytes of `fd` at `offset`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int pread_all(const int fd, char *buffer, const size_t length,
+                     const uint64_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    const ssize_t bytes_read =
+        pread(fd, buffer + done, length - done, offset + done);
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("pread");
+      return -1;
+    }
+    if (bytes_read == 0) {
+      syslog(LOG_ERR, "history ends early");
+      return -1;
+    }
+    done += bytes_read;
+  }
+  return 0;
+}
+
+/**
+ * @brief Opens COLD_HISTORY_FILE for `reader` unless it already is
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int open_cold_history(HistoryReader *reader) {
+  if (reader->cold_fd == -1) {
+    reader->cold_fd = open(COLD_HISTORY_FILE, O_RDONLY);
+    if (reader->cold_fd == -1) {
+      perror("open");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Decompresses cold segment `index` into `reader->segment_data`. The
+ * caller must hold `cold_lock`.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int load_segment(HistoryReader *reader, const size_t index) {
+  const ColdSegment *segment = &cold_segments[index];
+  if (open_cold_history(reader)) {
+    return -1;
+  }
+
+  reader->segment = SIZE_MAX;
+  if (reserve(&reader->segment_data, &reader->segment_capacity,
+              segment->length)) {
+    return -1;
+  }
+
+  if (segment->compressed_length == segment->length) {
+    if (pread_all(reader->cold_fd, reader->segment_data, segment->length,
+                  segment->data_offset)) {
+      return -1;
+    }
+  } else {
+    if (reserve(&reader->compressed_data, &reader->compressed_capacity,
+                segment->compressed_length) ||
+        pread_all(reader->cold_fd, reader->compressed_data,
+                  segment->compressed_length, segment->data_offset)) {
+      return -1;
+    }
+    if (lz_decompress(reader->compressed_data, segment->compressed_length,
+                      reader->segment_data,
+                      segment->length) != (ssize_t)segment->length) {
+      syslog(LOG_ERR, "corrupt cold segment at %" PRIu64, segment->offset);
+      return -1;
+    }
+  }
+
+  reader->segment = index;
+  return 0;
+}
+
+/**
+ * @brief returns the index of the cold segment holding `offset`, which must be
+ * below `cold_end`. The caller must hold `cold_lock`.
+ */
+static size_t find_cold_segment(const uint64_t offset) {
+  // Segments are contiguous from 0
+  size_t low = 0;
+  size_t high = cold_segment_count;
+  while (high - low > 1) {
+    const size_t middle = low + (high - low) / 2;
+    if (cold_segments[middle].offset <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * @brief Reads up to `length` bytes of RESULT_FILE at `offset` into `buffer`,
+ * from the cold segment holding them if they were moved there
+ * @return the number of bytes read, 0 at the end of the file
+ * @return -1 on error
+ */
+static ssize_t read_stored(HistoryReader *reader, char *buffer,
+                           const size_t length, const uint64_t offset) {
+  pthread_rwlock_rdlock(&cold_lock);
+  if (offset >= cold_end) {
+    const ssize_t bytes_read = pread(reader->fd, buffer, length, offset);
+    pthread_rwlock_unlock(&cold_lock);
+    if (bytes_read == -1) {
+      perror("pread");
+    }
+    return bytes_read;
+  }
+
+  const size_t index = find_cold_segment(offset);
+  if ((reader->segment != index) && load_segment(reader, index)) {
+    pthread_rwlock_unlock(&cold_lock);
+    return -1;
+  }
+
+  const ColdSegment *segment = &cold_segments[index];
+  const uint64_t available = segment->offset + segment->length - offset;
+  const size_t bytes_read = length < available ? length : available;
+  memcpy(buffer, reader->segment_data + (offset - segment->offset),
+         bytes_read);
+  pthread_rwlock_unlock(&cold_lock);
+  return bytes_read;
+}
+
+#if DEDUPLICATE_PACKETS == 1
+/**
+ * @brief returns the index of the packet holding `offset` of the history,
+ * which must be before the end of the last complete packet
+ */
+static uint64_t find_packet(const uint64_t offset) {
+  uint64_t low = 0;
+  uint64_t high = packet_count;
+  while (high - low > 1) {
+    const uint64_t middle = low + (high - low) / 2;
+    if (packet_offsets[middle] <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+#endif
+
+/**
+ * @brief Reads up to `length` bytes of the history at `offset` into `buffer`
+ * @return the number of bytes read, 0 at the end of the history
+ * @return -1 on error
+ */
+static ssize_t reader_read(HistoryReader *reader, char *buffer,
+                           const size_t length, const uint64_t offset) {
+#if DEDUPLICATE_PACKETS == 1
+  // Gather the packets from their payloads
+  pthread_rwlock_rdlock(&index_lock);
+  uint64_t seq = (offset < packet_offsets[packet_count]) ? find_packet(offset)
+                                                         : packet_count;
+  size_t bytes_read = 0;
+  while ((bytes_read < length) && (offset + bytes_read < file_size)) {
+    const uint64_t position = offset + bytes_read;
+    while ((seq < packet_count) && (packet_offsets[seq + 1] <= position)) {
+      seq++;
+    }
+
+    // The incomplete packet is stored as is after the payloads
+    const uint64_t payload_offset = (seq < packet_count)
+                                        ? payload_offsets[packet_payloads[seq]]
+                                        : payload_offsets[payload_count];
+    const uint64_t available = (seq < packet_count)
+                                   ? packet_offsets[seq + 1] - position
+                                   : file_size - position;
+    const ssize_t piece = read_stored(
+        reader, buffer + bytes_read,
+        length - bytes_read < available ? length - bytes_read : available,
+        payload_offset + (position - packet_offsets[seq]));
+    if (piece <= 0) {
+      syslog(LOG_ERR, "payload of packet %" PRIu64 " unreadable", seq);
+      pthread_rwlock_unlock(&index_lock);
+      return -1;
+    }
+    bytes_read += piece;
+  }
+  pthread_rwlock_unlock(&index_lock);
+  return bytes_read;
+#else
+  return read_stored(reader, buffer, length, offset);
+#endif
+}
+
+/**
+ * @brief Makes room in the index for one more packet
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int grow_packet_index(void) {
+  if (packet_count + 1 < packet_offsets_capacity) {
+    return 0;
+  }
+
+  // Grow geometrically so appends take amortised constant time
+  uint64_t *grown_offsets = realloc(
+      packet_offsets, 2 * packet_offsets_capacity * sizeof(*packet_offsets));
+  if (grown_offsets == NULL) {
+    syslog(LOG_ERR, "realloc packet_offsets");
+    return -1;
+  }
+  packet_offsets = grown_offsets;
+#if DEDUPLICATE_PACKETS == 1
+  uint32_t *grown_payloads = realloc(
+      packet_payloads, 2 * packet_offsets_capacity * sizeof(*packet_payloads));
+  if (grown_payloads == NULL) {
+    syslog(LOG_ERR, "realloc packet_payloads");
+    return -1;
+  }
+  packet_payloads = grown_payloads;
+#endif
+  packet_offsets_capacity *= 2;
+  return 0;
+}
+
+#if DEDUPLICATE_PACKETS == 1
+/**
+ * @brief returns the slot of `payload_table` for `hash`, either holding the
+ * newest payload with that hash or empty
+ */
+static size_t payload_slot(const uint64_t hash) {
+  const size_t mask = payload_table_capacity - 1;
+  size_t slot = hash & mask;
+  while ((payload_table[slot] != 0) &&
+         (payload_hashes[payload_table[slot] - 1] != hash)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+/**
+ * @brief Doubles the capacity of `payload_table`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int grow_payload_table(void) {
+  uint32_t *old_table = payload_table;
+  const size_t old_capacity = payload_table_capacity;
+  payload_table = calloc(2 * old_capacity, sizeof(*payload_table));
+  if (payload_table == NULL) {
+    syslog(LOG_ERR, "calloc payload_table");
+    payload_table = old_table;
+    return -1;
+  }
+
+  payload_table_capacity = 2 * old_capacity;
+  for (size_t slot = 0; slot < old_capacity; slot++) {
+    if (old_table[slot] != 0) {
+      payload_table[payload_slot(payload_hashes[old_table[slot] - 1])] =
+          old_table[slot];
+    }
+  }
+  free(old_table);
+  return 0;
+}
+
+/**
+ * @brief Adds the payload stored from the end of the last one to `end`. It
+ * replaces any older payload with the same `hash` in `payload_table`.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int add_payload(const uint64_t end, const uint64_t hash) {
+  if (payload_count + 1 == payload_capacity) {
+    uint64_t *grown_offsets = realloc(
+        payload_offsets, 2 * payload_capacity * sizeof(*payload_offsets));
+    if (grown_offsets == NULL) {
+      syslog(LOG_ERR, "realloc payload_offsets");
+      return -1;
+    }
+    payload_offsets = grown_offsets;
+    uint64_t *grown_hashes = realloc(
+        payload_hashes, 2 * payload_capacity * sizeof(*payload_hashes));
+    if (grown_hashes == NULL) {
+      syslog(LOG_ERR, "realloc payload_hashes");
+      return -1;
+    }
+    payload_hashes = grown_hashes;
+    payload_capacity *= 2;
+  }
+  if (payload_count == UINT32_MAX - 1) {
+    syslog(LOG_ERR, "too many payloads");
+    return -1;
+  }
+  // Keep the table at most half full so probes stay short
+  if ((2 * (payload_count + 1) > payload_table_capacity) &&
+      grow_payload_table()) {
+    return -1;
+  }
+
+  payload_hashes[payload_count] = hash;
+  payload_offsets[payload_count + 1] = end;
+  payload_table[payload_slot(hash)] = payload_count + 1;
+  payload_count++;
+  return 0;
+}
+
+/**
+ * @brief Adds a packet stored as `payload` after the last complete packet
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int index_packet(const uint32_t payload) {
+  if (grow_packet_index()) {
+    return -1;
+  }
+
+  packet_payloads[packet_count] = payload;
+  packet_offsets[packet_count + 1] = packet_offsets[packet_count] +
+                                     payload_offsets[payload + 1] -
+                                     payload_offsets[payload];
+  packet_count++;
+  return 0;
+}
+#endif
+
+#if DEDUPLICATE_PACKETS != 1
+/**
+ * @brief Indexes the packets completed by `data`, which was appended at the
+ * end of the file
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int index_packets(const char *data, const size_t length) {
+  const char *newline = data;
+  while ((newline = memchr(newline, '\n', data + length - newline)) != NULL) {
+    newline++;
+    if (grow_packet_index()) {
+      return -1;
+    }
+
+    packet_count++;
+    packet_offsets[packet_count] = file_size + (newline - data);
+  }
+
+  file_size += length;
+  return 0;
+}
+#else
+/**
+ * @brief Indexes the payloads in `data`, read from RESULT_FILE after the ones
+ * already indexed
+ * @param hash pointer to the hash of the bytes before `data` that are not in
+ * a payload yet, updated for the next call
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int index_payloads(const char *data, const size_t length,
+                          uint64_t *hash) {
+  const char *payload = data;
+  const char *newline = NULL;
+  while ((newline = memchr(payload, '\n', data + length - payload)) != NULL) {
+    newline++;
+    *hash = fnv1a_hash(*hash, payload, newline - payload);
+    if (add_payload(stored_size + (newline - data), *hash)) {
+      return -1;
+    }
+    *hash = FNV1A_OFFSET_BASIS;
+    payload = newline;
+  }
+
+  *hash = fnv1a_hash(*hash, payload, data + length - payload);
+  stored_size += length;
+  return 0;
+}
+
+/**
+ * @brief Indexes the packets listed in PACKET_MAP_FILE. A RESULT_FILE written
+ * without deduplication has no map, each of its lines is a packet and the map
+ * is written for them. Entries a crash cut short, or that refer to a payload
+ * that was never stored, are dropped.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int load_packet_map(void) {
+  const int fd = open(PACKET_MAP_FILE, O_RDWR);
+  if (fd == -1) {
+    if (errno != ENOENT) {
+      perror("open");
+      return -1;
+    }
+
+    if (payload_count == 0) {
+      return 0;
+    }
+    uint32_t *payloads = malloc(payload_count * sizeof(uint32_t));
+    if (payloads == NULL) {
+      syslog(LOG_ERR, "malloc packet map");
+      return -1;
+    }
+    int result = 0;
+    for (uint32_t payload = 0; (result == 0) && (payload < payload_count);
+         payload++) {
+      payloads[payload] = payload;
+      result = index_packet(payload);
+    }
+    if ((result == 0) &&
+        (append_to_file(PACKET_MAP_FILE, (char *)payloads,
+                        payload_count * sizeof(uint32_t)) == -1)) {
+      syslog(LOG_ERR, "append_to_file");
+      result = -1;
+    }
+    free(payloads);
+    return result;
+  }
+
+  uint32_t payloads[BUFFER_SIZE / sizeof(uint32_t)];
+  uint64_t position = 0;
+  bool is_valid = true;
+  while (is_valid) {
+    const ssize_t bytes_read = pread(fd, payloads, sizeof(payloads), position);
+    if (bytes_read == -1) {
+      perror("pread");
+      close(fd);
+      return -1;
+    }
+
+    const size_t count = bytes_read / sizeof(uint32_t);
+    is_valid = count > 0;
+    for (size_t index = 0; is_valid && (index < count); index++) {
+      is_valid = payloads[index] < payload_count;
+      if (is_valid && index_packet(payloads[index])) {
+        close(fd);
+        return -1;
+      }
+      position += is_valid ? sizeof(uint32_t) : 0;
+    }
+  }
+
+  struct stat map_stat;
+  if ((fstat(fd, &map_stat) == 0) && (position < (uint64_t)map_stat.st_size) &&
+      (ftruncate(fd, position) == -1)) {
+    perror("ftruncate");
+  }
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief Checks the payload `payload` holds the bytes of `packet`
+ * @param fd RESULT_FILE
+ * @param stored bytes not written yet, that will be stored from `stored_offset`
+ * @return true if it does
+ */
+static bool payload_equals(const uint32_t payload, const char *packet,
+                           const size_t length, const int fd,
+                           const char *stored, const uint64_t stored_offset) {
+  const uint64_t offset = payload_offsets[payload];
+  if (payload_offsets[payload + 1] - offset != length) {
+    return false;
+  }
+  if (offset >= stored_offset) {
+    return memcmp(stored + (offset - stored_offset), packet, length) == 0;
+  }
+
+  // A payload moved to the cold history reads back as a hole and doesn't
+  // match, so the packet is stored again where it is cheap to compare
+  char *copy = malloc(length);
+  if (copy == NULL) {
+    syslog(LOG_ERR, "malloc payload copy");
+    return false;
+  }
+  const bool is_equal = (pread_all(fd, copy, length, offset) == 0) &&
+                        (memcmp(copy, packet, length) == 0);
+  free(copy);
+  return is_equal;
+}
+
+/**
+ * @brief Stores `data`, appended at the end of the history. Each packet it
+ * completes refers to the payload holding the same bytes, which is stored
+ * first if there is none. The incomplete packet after the last newline is
+ * stored as is.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int store_packets(char *data, const size_t length) {
+  if (memchr(data, '\n', length) == NULL) {
+    // Only the incomplete packet grows
+    if (append_to_file(RESULT_FILE, data, length) == -1) {
+      syslog(LOG_ERR, "append_to_file");
+      return -1;
+    }
+    pthread_rwlock_wrlock(&index_lock);
+    stored_size += length;
+    file_size += length;
+    pthread_rwlock_unlock(&index_lock);
+    return 0;
+  }
+
+  const int fd =
+      open(RESULT_FILE, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  // The incomplete packet is stored again along with the rest of it
+  const uint64_t stored_offset = payload_offsets[payload_count];
+  const size_t incomplete_length = stored_size - stored_offset;
+  const size_t input_length = incomplete_length + length;
+  char *input = malloc(input_length);
+  char *stored = malloc(input_length);
+  uint32_t *payloads = malloc(count_newlines(data, length) * sizeof(uint32_t));
+  if ((input == NULL) || (stored == NULL) || (payloads == NULL) ||
+      pread_all(fd, input, incomplete_length, stored_offset)) {
+    syslog(LOG_ERR, "store_packets setup");
+    free(input);
+    free(stored);
+    free(payloads);
+    close(fd);
+    return -1;
+  }
+  memcpy(input + incomplete_length, data, length);
+
+  pthread_rwlock_wrlock(&index_lock);
+  int result = 0;
+  size_t stored_length = 0;
+  size_t packets = 0;
+  const char *packet = input;
+  const char *end = input + input_length;
+  const char *newline = NULL;
+  while ((result == 0) &&
+         ((newline = memchr(packet, '\n', end - packet)) != NULL)) {
+    const size_t packet_length = newline + 1 - packet;
+    const uint64_t hash = fnv1a_hash(FNV1A_OFFSET_BASIS, packet, packet_length);
+    const uint32_t found = payload_table[payload_slot(hash)];
+    if ((found != 0) && payload_equals(found - 1, packet, packet_length, fd,
+                                       stored, stored_offset)) {
+      payloads[packets++] = found - 1;
+    } else {
+      memcpy(stored + stored_length, packet, packet_length);
+      stored_length += packet_length;
+      result = add_payload(stored_offset + stored_length, hash);
+      payloads[packets++] = payload_count - 1;
+    }
+    packet = newline + 1;
+  }
+  memcpy(stored + stored_length, packet, end - packet);
+  stored_length += end - packet;
+
+  // Payloads are written before the packets that refer to them
+  if ((result == 0) && (incomplete_length > 0) &&
+      (ftruncate(fd, stored_offset) == -1)) {
+    perror("ftruncate");
+    result = -1;
+  }
+  if ((result == 0) &&
+      ((append_to_file(RESULT_FILE, stored, stored_length) == -1) ||
+       (append_to_file(PACKET_MAP_FILE, (char *)payloads,
+                       packets * sizeof(uint32_t)) == -1))) {
+    syslog(LOG_ERR, "append_to_file");
+    result = -1;
+  }
+
+  if (result == 0) {
+    stored_size = stored_offset + stored_length;
+    for (size_t index = 0; (result == 0) && (index < packets); index++) {
+      result = index_packet(payloads[index]);
+    }
+    file_size += length;
+  }
+  pthread_rwlock_unlock(&index_lock);
+
+  free(input);
+  free(stored);
+  free(payloads);
+  close(fd);
+  return result;
+}
+#endif
+
+/**
+ * @brief Adds a segment to the index of the cold history
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int add_cold_segment(const ColdSegment *segment) {
+  if (cold_segment_count == cold_segments_capacity) {
+    const size_t capacity =
+        cold_segments_capacity ? 2 * cold_segments_capacity : 16;
+    ColdSegment *grown_segments =
+        realloc(cold_segments, capacity * sizeof(ColdSegment));
+    if (grown_segments == NULL) {
+      syslog(LOG_ERR, "realloc cold_segments");
+      return -1;
+    }
+    cold_segments = grown_segments;
+    cold_segments_capacity = capacity;
+  }
+
+  cold_segments[cold_segment_count++] = *segment;
+  cold_end = segment->offset + segment->length;
+  return 0;
+}
+
+/**
+ * @brief Rebuilds the index of the cold history an earlier run left behind.
+ * A segment cut short, by a crash while it was written, is dropped, its bytes
+ * are still in RESULT_FILE.
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int load_cold_segments(void) {
+  const int fd = open(COLD_HISTORY_FILE, O_RDWR);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    perror("open");
+    return -1;
+  }
+
+  struct stat cold_stat;
+  if (fstat(fd, &cold_stat) == -1) {
+    perror("fstat");
+    close(fd);
+    return -1;
+  }
+
+  uint64_t position = 0;
+  ColdSegmentHeader header;
+  while ((position + sizeof(header) <= (uint64_t)cold_stat.st_size) &&
+         (pread_all(fd, (char *)&header, sizeof(header), position) == 0) &&
+         (header.magic == COLD_SEGMENT_MAGIC) && (header.offset == cold_end) &&
+         (header.compressed_length <= header.length) &&
+         (position + sizeof(header) + header.compressed_length <=
+          (uint64_t)cold_stat.st_size)) {
+    const ColdSegment segment = {
+        .offset = header.offset,
+        .length = header.length,
+        .data_offset = position + sizeof(header),
+        .compressed_length = header.compressed_length,
+    };
+    if (add_cold_segment(&segment)) {
+      close(fd);
+      return -1;
+    }
+    position = segment.data_offset + segment.compressed_length;
+  }
+
+  if ((position < (uint64_t)cold_stat.st_size) &&
+      (ftruncate(fd, position) == -1)) {
+    perror("ftruncate");
+  }
+  close(fd);
+  return 0;
+}
+
+int storage_init(void) {
+  packet_offsets_capacity = 1024;
+  packet_offsets = malloc(packet_offsets_capacity * sizeof(*packet_offsets));
+  if (packet_offsets == NULL) {
+    syslog(LOG_ERR, "malloc packet_offsets");
+    return -1;
+  }
+  packet_offsets[0] = 0;
+  packet_count = 0;
+  file_size = 0;
+#if DEDUPLICATE_PACKETS == 1
+  payload_capacity = 1024;
+  payload_offsets = malloc(payload_capacity * sizeof(*payload_offsets));
+  payload_hashes = malloc(payload_capacity * sizeof(*payload_hashes));
+  payload_table_capacity = 1024;
+  payload_table = calloc(payload_table_capacity, sizeof(*payload_table));
+  packet_payloads =
+      malloc(packet_offsets_capacity * sizeof(*packet_payloads));
+  if ((payload_offsets == NULL) || (payload_hashes == NULL) ||
+      (payload_table == NULL) || (packet_payloads == NULL)) {
+    syslog(LOG_ERR, "malloc payload index");
+    return -1;
+  }
+  payload_offsets[0] = 0;
+  payload_count = 0;
+  stored_size = 0;
+#endif
+
+  // Index what an earlier run left behind
+  struct stat result_stat;
+  if (stat(RESULT_FILE, &result_stat) == -1) {
+    if (errno != ENOENT) {
+      perror("stat");
+      return -1;
+    }
+    // The rest of the history is of no use without it
+    if ((remove(COLD_HISTORY_FILE) == -1) && (errno != ENOENT)) {
+      perror("remove");
+    }
+    if ((remove(PACKET_MAP_FILE) == -1) && (errno != ENOENT)) {
+      perror("remove");
+    }
+    return 0;
+  }
+
+  if (load_cold_segments()) {
+    return -1;
+  }
+
+  HistoryReader reader;
+  if (reader_open(&reader)) {
+    return -1;
+  }
+
+  char buffer[BUFFER_SIZE];
+  ssize_t bytes_read = 0;
+  uint64_t offset = 0;
+#if DEDUPLICATE_PACKETS == 1
+  uint64_t hash = FNV1A_OFFSET_BASIS;
+#endif
+  while ((bytes_read = read_stored(&reader, buffer, sizeof(buffer), offset)) >
+         0) {
+    offset += bytes_read;
+#if DEDUPLICATE_PACKETS == 1
+    if (index_payloads(buffer, bytes_read, &hash) == -1) {
+#else
+    if (index_packets(buffer, bytes_read) == -1) {
+#endif
+      reader_close(&reader);
+      return -1;
+    }
+  }
+
+  reader_close(&reader);
+  if (bytes_read == -1) {
+    return -1;
+  }
+
+#if DEDUPLICATE_PACKETS == 1
+  if (load_packet_map()) {
+    return -1;
+  }
+  file_size = packet_offsets[packet_count] + stored_size -
+              payload_offsets[payload_count];
+#endif
+  return 0;
+}
+
+void storage_free(void) {
+  free(packet_offsets);
+  packet_offsets = NULL;
+  packet_offsets_capacity = 0;
+  free(cold_segments);
+  cold_segments = NULL;
+  cold_segment_count = 0;
+  cold_segments_capacity = 0;
+  cold_end = 0;
+  for (size_t index = 0; index < COMPRESSED_CHUNK_CACHE_SIZE; index++) {
+    free(compressed_chunks[index].data);
+    compressed_chunks[index].data = NULL;
+    compressed_chunks[index].is_valid = false;
+  }
+#if DEDUPLICATE_PACKETS == 1
+  free(payload_offsets);
+  payload_offsets = NULL;
+  free(payload_hashes);
+  payload_hashes = NULL;
+  payload_capacity = 0;
+  payload_count = 0;
+  free(payload_table);
+  payload_table = NULL;
+  payload_table_capacity = 0;
+  free(packet_payloads);
+  packet_payloads = NULL;
+  stored_size = 0;
+#endif
+}
+
+int storage_append(char *data, const size_t length, uint64_t *next_seq_rtn) {
+#if DEDUPLICATE_PACKETS == 1
+  if (store_packets(data, length) == -1) {
+    return -1;
+  }
+#else
+  if (append_to_file(RESULT_FILE, data, length) == -1) {
+    syslog(LOG_ERR, "append_to_file");
+    return -1;
+  }
+
+  if (index_packets(data, length) == -1) {
+    return -1;
+  }
+#endif
+
+  if (next_seq_rtn != NULL) {
+    *next_seq_rtn = packet_count;
+  }
+  return 0;
+}
+
+int storage_get_bounds(uint64_t *first_seq_rtn, uint64_t *next_seq_rtn) {
+  *first_seq_rtn = 0;
+  *next_seq_rtn = packet_count;
+  return 0;
+}
+
+#if DEDUPLICATE_PACKETS != 1
+/**
+ * @brief Sends the cold segment starting at `offset` to `client` as the frame
+ * it was compressed into, if it ends by `end` and fits in one frame
+ * @return the number of bytes of history sent, 0 if there is no such segment
+ * @return -1 otherwise
+ */
+static ssize_t send_cold_frame(const ClientConnection *client,
+                               HistoryReader *reader, const uint64_t offset,
+                               const uint64_t end) {
+  ColdSegment segment = {0};
+  pthread_rwlock_rdlock(&cold_lock);
+  if (offset < cold_end) {
+    segment = cold_segments[find_cold_segment(offset)];
+  }
+  pthread_rwlock_unlock(&cold_lock);
+  if ((segment.length == 0) || (segment.offset != offset) ||
+      (segment.offset + segment.length > end) ||
+      (segment.length > PROTOCOL_MAX_FRAME_SIZE)) {
+    return 0;
+  }
+
+  // Segments never change once written, no lock is needed to read one
+  if (open_cold_history(reader) ||
+      reserve(&reader->compressed_data, &reader->compressed_capacity,
+              segment.compressed_length) ||
+      pread_all(reader->cold_fd, reader->compressed_data,
+                segment.compressed_length, segment.data_offset) ||
+      socket_client_send_frame(client, reader->compressed_data,
+                               segment.compressed_length, segment.length)) {
+    return -1;
+  }
+  return segment.length;
+}
+#endif
+
+/**
+ * @brief Compresses the chunk of history at `offset` into `chunk`
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int compress_chunk(HistoryReader *reader, const uint64_t offset,
+                          CompressedChunk *chunk) {
+  free(chunk->data);
+  chunk->data = NULL;
+  chunk->is_valid = false;
+
+  char *raw = malloc(COMPRESSED_FRAME_SIZE);
+  char *compressed = malloc(COMPRESSED_FRAME_SIZE);
+  if ((raw == NULL) || (compressed == NULL)) {
+    syslog(LOG_ERR, "malloc compressed chunk");
+    free(raw);
+    free(compressed);
+    return -1;
+  }
+
+  for (size_t length = 0; length < COMPRESSED_FRAME_SIZE;) {
+    const ssize_t bytes_read =
+        reader_read(reader, raw + length, COMPRESSED_FRAME_SIZE - length,
+                    offset + length);
+    if (bytes_read <= 0) {
+      syslog(LOG_ERR, "reader_read");
+      free(raw);
+      free(compressed);
+      return -1;
+    }
+    length += bytes_read;
+  }
+
+  // Keep data that doesn't compress as is
+  chunk->length = lz_compress(raw, COMPRESSED_FRAME_SIZE, compressed,
+                              COMPRESSED_FRAME_SIZE - 1);
+  if (chunk->length == 0) {
+    chunk->length = COMPRESSED_FRAME_SIZE;
+    chunk->data = raw;
+    free(compressed);
+  } else {
+    char *shrunk = realloc(compressed, chunk->length);
+    chunk->data = (shrunk != NULL) ? shrunk : compressed;
+    free(raw);
+  }
+
+  chunk->offset = offset;
+  chunk->is_valid = true;
+  return 0;
+}
+
+/**
+ * @brief Sends the chunk of history starting at `offset` to `client` from the
+ * cache, compressing it first if it isn't cached, if `offset` is the start of
+ * a chunk that ends by `end`
+ * @return the number of bytes of history sent, 0 if there is no such chunk
+ * @return -1 otherwise
+ */
+static ssize_t send_cached_chunk(const ClientConnection *client,
+                                 HistoryReader *reader, const uint64_t offset,
+                                 const uint64_t end) {
+  if ((offset % COMPRESSED_FRAME_SIZE != 0) ||
+      (end - offset < COMPRESSED_FRAME_SIZE)) {
+    return 0;
+  }
+
+  CompressedChunk *chunk =
+      &compressed_chunks[(offset / COMPRESSED_FRAME_SIZE) %
+                         COMPRESSED_CHUNK_CACHE_SIZE];
+  if ((!chunk->is_valid || (chunk->offset != offset)) &&
+      compress_chunk(reader, offset, chunk)) {
+    return -1;
+  }
+
+  if (socket_client_send_frame(client, chunk->data, chunk->length,
+                               COMPRESSED_FRAME_SIZE)) {
+    return -1;
+  }
+  return COMPRESSED_FRAME_SIZE;
+}
+
+int storage_send_range(const ClientConnection *client, const uint64_t offset,
+                       uint64_t length) {
+  if (offset >= file_size) {
+    return 0;
+  }
+  if (length > file_size - offset) {
+    length = file_size - offset;
+  }
+
+  HistoryReader reader;
+  if (reader_open(&reader)) {
+    return -1;
+  }
+
+  char *chunk = malloc(SEND_CHUNK_SIZE);
+  if (chunk == NULL) {
+    syslog(LOG_ERR, "malloc chunk");
+    reader_close(&reader);
+    return -1;
+  }
+
+  int result = 0;
+  uint64_t position = offset;
+  const uint64_t end = offset + length;
+  while (position < end) {
+    uint64_t piece = end - position;
+    if (client->is_compressed) {
+      // Whole cold segments and chunks are sent as they were compressed
+      ssize_t bytes_sent = 0;
+#if DEDUPLICATE_PACKETS != 1
+      // Only without deduplication do segments hold the history as is
+      bytes_sent = send_cold_frame(client, &reader, position, end);
+#endif
+      if (bytes_sent == 0) {
+        bytes_sent = send_cached_chunk(client, &reader, position, end);
+      }
+      if (bytes_sent == -1) {
+        result = -1;
+        break;
+      }
+      if (bytes_sent > 0) {
+        position += bytes_sent;
+        continue;
+      }
+
+      // Compress the rest on its own, up to where the next chunk starts
+      const uint64_t chunk_remaining =
+          COMPRESSED_FRAME_SIZE - position % COMPRESSED_FRAME_SIZE;
+      if (piece > chunk_remaining) {
+        piece = chunk_remaining;
+      }
+    }
+
+    const ssize_t bytes_read = reader_read(
+        &reader, chunk, piece < SEND_CHUNK_SIZE ? piece : SEND_CHUNK_SIZE,
+        position);
+    if (bytes_read <= 0) {
+      result = bytes_read;
+      break;
+    }
+
+    if (socket_client_send_line(client, chunk, bytes_read)) {
+      syslog(LOG_ERR, "socket_client_send_line send");
+      result = -1;
+      break;
+    }
+    position += bytes_read;
+  }
+
+  free(chunk);
+  reader_close(&reader);
+  return result;
+}
+
+int storage_send_history(const ClientConnection *client) {
+  return storage_send_range(client, 0, file_size);
+}
+
+int storage_send_packets(const ClientConnection *client, const uint64_t seq,
+                         const uint64_t count) {
+  const uint64_t offset = packet_offsets[seq];
+  return storage_send_range(client, offset,
+                            packet_offsets[seq + count] - offset);
+}
+
+int storage_scan(uint64_t seq, uint64_t next_seq, StorageScanCallback callback,
+                 void *context) {
+  // Bytes already written never change, only the index needs the lock
+  pthread_mutex_lock(config_get_result_file_mutex());
+  if (next_seq > packet_count) {
+    next_seq = packet_count;
+  }
+  if (seq >= next_seq) {
+    pthread_mutex_unlock(config_get_result_file_mutex());
+    return 0;
+  }
+  uint64_t offset = packet_offsets[seq];
+  const uint64_t end_offset = packet_offsets[next_seq];
+  pthread_mutex_unlock(config_get_result_file_mutex());
+
+  HistoryReader reader;
+  if (reader_open(&reader)) {
+    return -1;
+  }
+
+  size_t capacity = SCAN_CHUNK_SIZE;
+  char *chunk = malloc(capacity);
+  if (chunk == NULL) {
+    syslog(LOG_ERR, "malloc scan chunk");
+    reader_close(&reader);
+    return -1;
+  }
+
+  int result = 0;
+  size_t buffered = 0;
+  while ((result == 0) && (offset < end_offset)) {
+    if (buffered == capacity) {
+      // A packet longer than the chunk
+      char *grown_chunk = realloc(chunk, 2 * capacity);
+      if (grown_chunk == NULL) {
+        syslog(LOG_ERR, "realloc scan chunk");
+        result = -1;
+        break;
+      }
+      chunk = grown_chunk;
+      capacity *= 2;
+    }
+
+    const uint64_t remaining = end_offset - offset;
+    const ssize_t bytes_read = reader_read(
+        &reader, chunk + buffered,
+        remaining < capacity - buffered ? remaining : capacity - buffered,
+        offset);
+    if (bytes_read <= 0) {
+      syslog(LOG_ERR, "reader_read");
+      result = -1;
+      break;
+    }
+    offset += bytes_read;
+    buffered += bytes_read;
+
+    // Pass the whole packets, keep the start of the last one for the next read
+    size_t packets_length = buffered;
+    while ((packets_length > 0) && (chunk[packets_length - 1] != '\n')) {
+      packets_length--;
+    }
+    if (packets_length == 0) {
+      continue;
+    }
+
+    result = callback(chunk, packets_length, seq, context);
+    seq += count_newlines(chunk, packets_length);
+    memmove(chunk, chunk + packets_length, buffered - packets_length);
+    buffered -= packets_length;
+  }
+
+  free(chunk);
+  reader_close(&reader);
+  return result;
+}
+
+/**
+ * @brief Writes the compressed segment to the end of COLD_HISTORY_FILE
+ * @param segment the segment, `data_offset` is filled in
+ * @return 0 if successful
+ * @return -1 otherwise
+ */
+static int write_cold_segment(ColdSegment *segment, const char *data) {
+  const int fd = open(COLD_HISTORY_FILE, O_WRONLY | O_CREAT,
+                      S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    perror("open");
+    return -1;
+  }
+
+  const off_t position = lseek(fd, 0, SEEK_END);
+  const ColdSegmentHeader header = {
+      .magic = COLD_SEGMENT_MAGIC,
+      .offset = segment->offset,
+      .length = segment->length,
+      .compressed_length = segment->compressed_length,
+  };
+  struct iovec iov[2] = {
+      {.iov_base = (void *)&header, .iov_len = sizeof(header)},
+      {.iov_base = (void *)data, .iov_len = segment->compressed_length},
+  };
+  const ssize_t written = (position == -1) ? -1 : writev(fd, iov, 2);
+  if (written != (ssize_t)(sizeof(header) + segment->compressed_length)) {
+    syslog(LOG_ERR, "writev cold segment");
+    // Don't leave a partial segment behind
+    if ((position != -1) && (ftruncate(fd, position) == -1)) {
+      perror("ftruncate");
+    }
+    close(fd);
+    return -1;
+  }
+
+  segment->data_offset = position + sizeof(header);
+  close(fd);
+  return 0;
+}
+
+int storage_compress_cold_history(void) {
+  // Only this function moves `cold_end`, no lock is needed to read it here
+  const uint64_t start = cold_end;
+
+  // End the segment on the first line boundary COLD_SEGMENT_SIZE bytes on,
+  // as long as HOT_HISTORY_SIZE bytes remain after it
+  pthread_mutex_lock(config_get_result_file_mutex());
+#if DEDUPLICATE_PACKETS == 1
+  const uint64_t *line_offsets = payload_offsets;
+  const uint64_t line_count = payload_count;
+  const uint64_t size = stored_size;
+#else
+  const uint64_t *line_offsets = packet_offsets;
+  const uint64_t line_count = packet_count;
+  const uint64_t size = file_size;
+#endif
+  uint64_t low = 0;
+  uint64_t high = line_count + 1;
+  while (low < high) {
+    const uint64_t middle = low + (high - low) / 2;
+    if (line_offsets[middle] < start + COLD_SEGMENT_SIZE) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  const uint64_t end = (low <= line_count) ? line_offsets[low] : 0;
+  const bool is_due = (end != 0) && (size - end >= HOT_HISTORY_SIZE);
+  pthread_mutex_unlock(config_get_result_file_mutex());
+  if (!is_due) {
+    return 1;
+  }
+
+  ColdSegment segment = {.offset = start, .length = end - start};
+  char *raw = malloc(segment.length);
+  char *compressed = malloc(segment.length);
+  const int fd = open(RESULT_FILE, O_RDWR);
+  int result = -1;
+  if ((raw == NULL) || (compressed == NULL) || (fd == -1)) {
+    syslog(LOG_ERR, "compress_cold_history setup");
+  } else if (pread_all(fd, raw, segment.length, start) == 0) {
+    // Keep data that doesn't compress as is
+    segment.compressed_length =
+        lz_compress(raw, segment.length, compressed, segment.length - 1);
+    const char *data = compressed;
+    if (segment.compressed_length == 0) {
+      segment.compressed_length = segment.length;
+      data = raw;
+    }
+    result = write_cold_segment(&segment, data);
+  }
+
+  if (result == 0) {
+    // Readers move to the segment before its bytes leave RESULT_FILE
+    pthread_rwlock_wrlock(&cold_lock);
+    result = add_cold_segment(&segment);
+    if ((result == 0) &&
+        (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   segment.offset, segment.length) == -1)) {
+      // The segment is still served from the cold history, only the disk
+      // space isn't reclaimed
+      syslog(LOG_WARNING, "fallocate: %s", strerror(errno));
+    }
+    pthread_rwlock_unlock(&cold_lock);
+  }
+
+  if (fd != -1) {
+    close(fd);
+  }
+  free(raw);
+  free(compressed);
+  return result;
+}
+
+#endif
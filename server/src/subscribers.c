@@ -0,0 +1,139 @@
+#include "subscribers.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "config.h"
+#include "packet.h"
+#include "queue.h"
+#include "utilities.h"
+
+static LIST_HEAD(subscriber_list, subscriber)
+    subscriber_list = LIST_HEAD_INITIALIZER(subscriber_list);
+static pthread_mutex_t subscriber_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int subscriber_init(struct subscriber *subscriber, const int client_fd) {
+  subscriber->client_fd = client_fd;
+  subscriber->dropped = 0;
+  subscriber->disconnected = false;
+  packet_ring_init(&subscriber->queue);
+
+  if (pthread_mutex_init(&subscriber->mutex, NULL)) {
+    syslog(LOG_ERR, "pthread_mutex_init");
+    return -1;
+  }
+
+  // Waits are timed against CLOCK_MONOTONIC, like the connection timeout
+  pthread_condattr_t condattr;
+  pthread_condattr_init(&condattr);
+  pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+  const int cond_result =
+      pthread_cond_init(&subscriber->packet_queued, &condattr);
+  pthread_condattr_destroy(&condattr);
+  if (cond_result) {
+    syslog(LOG_ERR, "pthread_cond_init");
+    pthread_mutex_destroy(&subscriber->mutex);
+    return -1;
+  }
+
+  return 0;
+}
+
+void subscriber_destroy(struct subscriber *subscriber) {
+  PacketRef *queued = NULL;
+  while ((queued = packet_ring_pop(&subscriber->queue)) != NULL) {
+    packet_put(*queued);
+  }
+
+  if (subscriber->dropped) {
+    syslog(LOG_WARNING, "Subscriber %d dropped %zu packets",
+           subscriber->client_fd, subscriber->dropped);
+  }
+
+  pthread_cond_destroy(&subscriber->packet_queued);
+  pthread_mutex_destroy(&subscriber->mutex);
+}
+
+int subscriber_wait(struct subscriber *subscriber, struct packet **packet,
+                    const struct timespec *timeout) {
+  struct timespec current_time;
+  clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+  struct timespec end_time;
+  timespec_add(&current_time, timeout, &end_time);
+
+  int result = 1;
+  pthread_mutex_lock(&subscriber->mutex);
+  while (packet_ring_is_empty(&subscriber->queue) &&
+         !subscriber->disconnected) {
+    if (pthread_cond_timedwait(&subscriber->packet_queued, &subscriber->mutex,
+                               &end_time) == ETIMEDOUT) {
+      break;
+    }
+  }
+
+  if (subscriber->disconnected) {
+    result = -1;
+  } else if (!packet_ring_is_empty(&subscriber->queue)) {
+    *packet = *packet_ring_pop(&subscriber->queue);
+    result = 0;
+  }
+  pthread_mutex_unlock(&subscriber->mutex);
+
+  return result;
+}
+
+void subscribers_add(struct subscriber *subscriber) {
+  pthread_mutex_lock(&subscriber_list_mutex);
+  LIST_INSERT_HEAD(&subscriber_list, subscriber, subscribers);
+  pthread_mutex_unlock(&subscriber_list_mutex);
+}
+
+void subscribers_remove(struct subscriber *subscriber) {
+  pthread_mutex_lock(&subscriber_list_mutex);
+  LIST_REMOVE(subscriber, subscribers);
+  pthread_mutex_unlock(&subscriber_list_mutex);
+}
+
+/**
+ * @brief Queues `packet` for `subscriber`, applying the drop policy when its
+ * queue is full
+ */
+static void subscriber_queue(struct subscriber *subscriber,
+                             struct packet *packet) {
+  pthread_mutex_lock(&subscriber->mutex);
+  if (subscriber->disconnected) {
+    pthread_mutex_unlock(&subscriber->mutex);
+    return;
+  }
+
+  if (packet_ring_is_full(&subscriber->queue)) {
+    subscriber->dropped++;
+#if SUBSCRIBER_DISCONNECT_WHEN_FULL == 1
+    subscriber->disconnected = true;
+    pthread_cond_signal(&subscriber->packet_queued);
+    pthread_mutex_unlock(&subscriber->mutex);
+    return;
+#else
+    // Make room by dropping the oldest queued packet
+    packet_put(*packet_ring_pop(&subscriber->queue));
+#endif
+  }
+
+  PacketRef reference = packet_get(packet);
+  packet_ring_push(&subscriber->queue, &reference);
+  pthread_cond_signal(&subscriber->packet_queued);
+  pthread_mutex_unlock(&subscriber->mutex);
+}
+
+void subscribers_publish(struct packet *packet) {
+  pthread_mutex_lock(&subscriber_list_mutex);
+  struct subscriber *subscriber = NULL;
+  LIST_FOREACH(subscriber, &subscriber_list, subscribers) {
+    subscriber_queue(subscriber, packet);
+  }
+  pthread_mutex_unlock(&subscriber_list_mutex);
+}
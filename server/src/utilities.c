@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <syslog.h>
 #include <time.h>
@@ -33,6 +34,24 @@ int append_to_file(const char *file, char *buffer, const size_t buffer_len) {
   return 0;
 }
 
+size_t count_newlines(const char *data, const size_t length) {
+  size_t count = 0;
+  const char *end = data + length;
+  while ((data = memchr(data, '\n', end - data)) != NULL) {
+    count++;
+    data++;
+  }
+  return count;
+}
+
+uint64_t fnv1a_hash(uint64_t hash, const char *data, const size_t length) {
+  for (size_t index = 0; index < length; index++) {
+    hash ^= (unsigned char)data[index];
+    hash *= 1099511628211ULL; // FNV prime
+  }
+  return hash;
+}
+
 int daemonize(void) {
   pid_t pid = fork();
   if (pid == -1) {
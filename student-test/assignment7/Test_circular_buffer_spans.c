@@ -0,0 +1,101 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+static char *test_strings[] = {"first\n", "second\n", "third\n"};
+
+/**
+ * Fills @param buffer with the test strings, after enough filler entries that
+ * the test strings wrap around the end of the entry array.
+ */
+static void fill_wrapped_buffer(struct aesd_circular_buffer *buffer)
+{
+    static char filler[] = "filler\n";
+    aesd_circular_buffer_init(buffer);
+    for (size_t index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1; index++) {
+        struct aesd_buffer_entry entry = {.buffptr = filler, .size = strlen(filler)};
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+    for (size_t index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 3; index++) {
+        aesd_circular_buffer_remove_entry(buffer);
+    }
+    for (size_t index = 0; index < 3; index++) {
+        struct aesd_buffer_entry entry = {.buffptr = test_strings[index],
+                                          .size = strlen(test_strings[index])};
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+    // Leave only the test strings
+    aesd_circular_buffer_remove_entry(buffer);
+    aesd_circular_buffer_remove_entry(buffer);
+}
+
+/**
+ * Copies the bytes described by @param spans into @param out, null terminated
+ */
+static void join_spans(const struct aesd_buffer_span *spans, size_t count, char *out)
+{
+    for (size_t index = 0; index < count; index++) {
+        memcpy(out, spans[index].buffptr, spans[index].size);
+        out += spans[index].size;
+    }
+    *out = '\0';
+}
+
+void test_spans_cover_range_across_wrapped_entries()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_span spans[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char joined[64];
+    size_t bytes = 0;
+    fill_wrapped_buffer(&buffer);
+
+    // "t\nsecond\nth" starts in the first entry and ends in the third
+    size_t count = aesd_circular_buffer_fill_spans(&buffer, 4, 11, spans,
+                                                   AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(3, count, "The range should touch three entries");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(11, bytes, "The spans should cover the whole range");
+    join_spans(spans, count, joined);
+    TEST_ASSERT_EQUAL_STRING("t\nsecond\nth", joined);
+}
+
+void test_spans_clip_at_end_of_data_and_max_spans()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_span spans[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char joined[64];
+    size_t bytes = 0;
+    fill_wrapped_buffer(&buffer);
+
+    size_t count = aesd_circular_buffer_fill_spans(&buffer, 13, 100, spans,
+                                                   AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT(1, count);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(6, bytes, "The range should stop at the end of the data");
+    join_spans(spans, count, joined);
+    TEST_ASSERT_EQUAL_STRING("third\n", joined);
+
+    count = aesd_circular_buffer_fill_spans(&buffer, 0, 100, spans, 2, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(2, count, "No more than max_spans spans should be filled");
+    TEST_ASSERT_EQUAL_UINT(13, bytes);
+
+    count = aesd_circular_buffer_fill_spans(&buffer, 19, 1, spans,
+                                            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &bytes);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, count, "An offset past the data should give no spans");
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+}
+
+void test_foreach_valid_visits_only_held_entries()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *entry;
+    size_t index;
+    fill_wrapped_buffer(&buffer);
+
+    size_t visited = 0;
+    AESD_CIRCULAR_BUFFER_FOREACH_VALID(entry, &buffer, index) {
+        TEST_ASSERT_EQUAL_PTR(test_strings[index], entry->buffptr);
+        visited++;
+    }
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(3, visited, "Only the three held entries should be visited");
+}
@@ -0,0 +1,157 @@
+#include "unity.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer-spmc.h"
+
+#define STRESS_CAPACITY 16
+#define STRESS_SLOT_SIZE 64
+#define STRESS_ENTRIES 200000
+#define STRESS_READERS 4
+
+/**
+ * Writes the contents expected for entry @param seq to @param out.
+ * @return the number of bytes written
+ */
+static size_t format_entry(uint64_t seq, char *out, size_t size)
+{
+    // Vary the length so a torn read also shows up as a size mismatch
+    return snprintf(out, size, "entry %" PRIu64 " %.*s\n", seq, (int)(seq % 16),
+                    "abcdefghijklmnop");
+}
+
+void test_spmc_reads_back_appended_entries()
+{
+    struct aesd_spmc_buffer buffer;
+    char out[STRESS_SLOT_SIZE];
+    size_t size = 0;
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_buffer_init(&buffer, 4, STRESS_SLOT_SIZE));
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_SPMC_EMPTY, aesd_spmc_buffer_read(&buffer, 0, out, sizeof(out), &size),
+                                  "Nothing should be readable before the first append");
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_buffer_append(&buffer, "write1\n", 7));
+    TEST_ASSERT_EQUAL_INT(AESD_SPMC_OK, aesd_spmc_buffer_read(&buffer, 0, out, sizeof(out), &size));
+    TEST_ASSERT_EQUAL_UINT(7, size);
+    TEST_ASSERT_EQUAL_MEMORY("write1\n", out, 7);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_SPMC_TOO_SMALL, aesd_spmc_buffer_read(&buffer, 0, out, 3, &size),
+                                  "A short destination should be reported");
+    TEST_ASSERT_EQUAL_UINT(7, size);
+
+    char too_large[STRESS_SLOT_SIZE + 1] = {0};
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_spmc_buffer_append(&buffer, too_large, sizeof(too_large)),
+                                  "Entries larger than a slot should be rejected");
+
+    aesd_spmc_buffer_free(&buffer);
+}
+
+void test_spmc_detects_overwritten_entries()
+{
+    struct aesd_spmc_buffer buffer;
+    char out[STRESS_SLOT_SIZE];
+    char expected[STRESS_SLOT_SIZE];
+    size_t size = 0;
+    uint64_t skipped = 0;
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_buffer_init(&buffer, 4, STRESS_SLOT_SIZE));
+
+    for (uint64_t seq = 0; seq < 10; seq++) {
+        size = format_entry(seq, expected, sizeof(expected));
+        aesd_spmc_buffer_append(&buffer, expected, size);
+    }
+    TEST_ASSERT_EQUAL_UINT64(10, aesd_spmc_buffer_head(&buffer));
+    TEST_ASSERT_EQUAL_UINT64(6, aesd_spmc_buffer_tail(&buffer));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_SPMC_OVERWRITTEN, aesd_spmc_buffer_read(&buffer, 5, out, sizeof(out), &size),
+                                  "Entry 5 should have been overwritten by entry 9");
+
+    // A consumer starting from the beginning skips to the oldest entry
+    uint64_t cursor = 0;
+    TEST_ASSERT_EQUAL_INT(AESD_SPMC_OK,
+                          aesd_spmc_buffer_read_next(&buffer, &cursor, out, sizeof(out), &size, &skipped));
+    TEST_ASSERT_EQUAL_UINT64(6, skipped);
+    TEST_ASSERT_EQUAL_UINT64(7, cursor);
+    TEST_ASSERT_EQUAL_UINT(format_entry(6, expected, sizeof(expected)), size);
+    TEST_ASSERT_EQUAL_MEMORY(expected, out, size);
+
+    aesd_spmc_buffer_free(&buffer);
+}
+
+struct stress_reader {
+    pthread_t thread;
+    struct aesd_spmc_buffer *buffer;
+    uint64_t entries_read;
+    uint64_t entries_skipped;
+    uint64_t errors;
+};
+
+static atomic_bool stress_done;
+
+static void *stress_reader_thread(void *arg)
+{
+    struct stress_reader *reader = arg;
+    char out[STRESS_SLOT_SIZE];
+    char expected[STRESS_SLOT_SIZE];
+    uint64_t cursor = 0;
+    bool done = false;
+
+    while (!done) {
+        // Check for completion before reading, so the last entries are drained
+        done = atomic_load(&stress_done);
+        size_t size = 0;
+        uint64_t skipped = 0;
+        const uint64_t seq_before = cursor;
+        enum aesd_spmc_result result;
+        while ((result = aesd_spmc_buffer_read_next(reader->buffer, &cursor, out, sizeof(out), &size,
+                                                    &skipped)) == AESD_SPMC_OK) {
+            const uint64_t seq = cursor - 1;
+            const size_t expected_size = format_entry(seq, expected, sizeof(expected));
+            if (size != expected_size || memcmp(out, expected, size) != 0 ||
+                seq < seq_before) {
+                reader->errors++;
+            }
+            reader->entries_read++;
+            reader->entries_skipped += skipped;
+        }
+        // Entries can also be skipped on the way to the head
+        reader->entries_skipped += skipped;
+        if (result != AESD_SPMC_EMPTY) {
+            reader->errors++;
+        }
+    }
+    return NULL;
+}
+
+void test_spmc_stress_one_producer_many_readers()
+{
+    struct aesd_spmc_buffer buffer;
+    struct stress_reader readers[STRESS_READERS];
+    char entry[STRESS_SLOT_SIZE];
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_buffer_init(&buffer, STRESS_CAPACITY, STRESS_SLOT_SIZE));
+    atomic_store(&stress_done, false);
+
+    for (size_t index = 0; index < STRESS_READERS; index++) {
+        memset(&readers[index], 0, sizeof(readers[index]));
+        readers[index].buffer = &buffer;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&readers[index].thread, NULL, stress_reader_thread,
+                                                &readers[index]));
+    }
+
+    for (uint64_t seq = 0; seq < STRESS_ENTRIES; seq++) {
+        const size_t size = format_entry(seq, entry, sizeof(entry));
+        TEST_ASSERT_EQUAL_INT(0, aesd_spmc_buffer_append(&buffer, entry, size));
+    }
+    atomic_store(&stress_done, true);
+
+    for (size_t index = 0; index < STRESS_READERS; index++) {
+        pthread_join(readers[index].thread, NULL);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, readers[index].errors,
+                                         "Readers should never see a torn or out of order entry");
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(STRESS_ENTRIES,
+                                         readers[index].entries_read + readers[index].entries_skipped,
+                                         "Every entry should be either read or reported as skipped");
+    }
+
+    aesd_spmc_buffer_free(&buffer);
+}
@@ -0,0 +1,139 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+// One instance wrapping with a mask, one wrapping with a compare
+DEFINE_RING(int_ring8, int, 8)
+DEFINE_RING(int_ring5, int, 5)
+
+struct message {
+    uint32_t id;
+    char text[16];
+};
+DEFINE_RING(message_ring, struct message, 4)
+
+static bool int_equals(const int *element, void *context)
+{
+    return *element == *(int *)context;
+}
+
+static bool message_has_id(const struct message *element, void *context)
+{
+    return element->id == *(uint32_t *)context;
+}
+
+void test_ring_push_pop_in_order()
+{
+    struct int_ring8 ring;
+    int_ring8_init(&ring);
+    TEST_ASSERT_TRUE(int_ring8_is_empty(&ring));
+    TEST_ASSERT_NULL_MESSAGE(int_ring8_pop(&ring), "An empty ring has nothing to pop");
+
+    for (int value = 0; value < 5; value++) {
+        int_ring8_push(&ring, &value);
+    }
+    TEST_ASSERT_EQUAL_UINT(5, int_ring8_count(&ring));
+    for (int value = 0; value < 5; value++) {
+        int *popped = int_ring8_pop(&ring);
+        TEST_ASSERT_NOT_NULL(popped);
+        TEST_ASSERT_EQUAL_INT(value, *popped);
+    }
+    TEST_ASSERT_TRUE(int_ring8_is_empty(&ring));
+}
+
+/**
+ * Pushes @param pushes consecutive values starting at 0 and checks only the
+ * newest `capacity` are kept, oldest first
+ */
+#define CHECK_OVERWRITE(name, capacity, pushes)                                 \
+    do {                                                                        \
+        struct name ring;                                                       \
+        name##_init(&ring);                                                     \
+        for (int value = 0; value < (pushes); value++) {                        \
+            name##_push(&ring, &value);                                         \
+        }                                                                       \
+        TEST_ASSERT_TRUE(name##_is_full(&ring));                                \
+        TEST_ASSERT_EQUAL_UINT((capacity), name##_count(&ring));                \
+        for (size_t index = 0; index < (capacity); index++) {                   \
+            int *element = name##_peek(&ring, index);                           \
+            TEST_ASSERT_NOT_NULL(element);                                      \
+            TEST_ASSERT_EQUAL_INT((pushes) - (capacity) + (int)index, *element); \
+        }                                                                       \
+        TEST_ASSERT_NULL(name##_peek(&ring, (capacity)));                       \
+    } while (0)
+
+void test_ring_overwrites_oldest_when_full()
+{
+    CHECK_OVERWRITE(int_ring8, 8, 8);
+    CHECK_OVERWRITE(int_ring8, 8, 21);
+    CHECK_OVERWRITE(int_ring5, 5, 5);
+    CHECK_OVERWRITE(int_ring5, 5, 13);
+}
+
+void test_ring_count_across_wrap()
+{
+    struct int_ring5 ring;
+    int_ring5_init(&ring);
+    for (int value = 0; value < 4; value++) {
+        int_ring5_push(&ring, &value);
+    }
+    int_ring5_pop(&ring);
+    int_ring5_pop(&ring);
+    int_ring5_pop(&ring);
+    for (int value = 4; value < 7; value++) {
+        int_ring5_push(&ring, &value);
+    }
+    // 3, 4, 5, 6 with `in` wrapped around before `out`
+    TEST_ASSERT_EQUAL_UINT(4, int_ring5_count(&ring));
+    TEST_ASSERT_FALSE(int_ring5_is_full(&ring));
+    TEST_ASSERT_EQUAL_INT(3, *int_ring5_peek(&ring, 0));
+    TEST_ASSERT_EQUAL_INT(6, *int_ring5_peek(&ring, 3));
+    TEST_ASSERT_NULL(int_ring5_peek(&ring, 4));
+}
+
+void test_ring_find_returns_oldest_match()
+{
+    struct int_ring5 ring;
+    int_ring5_init(&ring);
+    const int values[] = {9, 1, 7, 1, 3, 7, 2};
+    for (size_t index = 0; index < sizeof(values) / sizeof(values[0]); index++) {
+        int_ring5_push(&ring, &values[index]);
+    }
+
+    // Holds 7, 1, 3, 7, 2
+    int wanted = 7;
+    size_t index = 99;
+    int *found = int_ring5_find(&ring, int_equals, &wanted, &index);
+    TEST_ASSERT_NOT_NULL(found);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, index, "The oldest match should be found first");
+    wanted = 2;
+    found = int_ring5_find(&ring, int_equals, &wanted, &index);
+    TEST_ASSERT_NOT_NULL(found);
+    TEST_ASSERT_EQUAL_UINT(4, index);
+    wanted = 9;
+    TEST_ASSERT_NULL_MESSAGE(int_ring5_find(&ring, int_equals, &wanted, &index),
+                             "Overwritten elements should not be found");
+}
+
+void test_ring_of_structs()
+{
+    struct message_ring ring;
+    message_ring_init(&ring);
+    for (uint32_t id = 1; id <= 6; id++) {
+        struct message message = {.id = id};
+        snprintf(message.text, sizeof(message.text), "message %u", id);
+        struct message *slot = message_ring_push(&ring, &message);
+        TEST_ASSERT_EQUAL_UINT32(id, slot->id);
+    }
+
+    uint32_t wanted = 5;
+    size_t index = 0;
+    struct message *found = message_ring_find(&ring, message_has_id, &wanted, &index);
+    TEST_ASSERT_NOT_NULL(found);
+    TEST_ASSERT_EQUAL_UINT(2, index);
+    TEST_ASSERT_EQUAL_STRING("message 5", found->text);
+    TEST_ASSERT_EQUAL_UINT32(3, message_ring_pop(&ring)->id);
+}